@@ -10,6 +10,8 @@
 #include <voxelizer/ai_scene_loader.hpp>
 #include <voxelizer/voxelize.hpp>
 #include <voxelizer/octree_builder.hpp>
+#include <voxelizer/octree_io.hpp>
+#include <voxelizer/voxel_list_dedup.hpp>
 
 #include "scene_renderer.hpp"
 #include "octree_tracer.hpp"
@@ -99,21 +101,17 @@ std::pair<GLuint, size_t> load_octree_from_file(
 {
 	printf("Loading octree at \"%s\"\n", filename);
 
-	uint32_t version{};
-	uint32_t octree_bytesize{};
+	// The file is mapped and streamed to the GPU, it's never copied as a whole on the heap
+	voxelizer::mapped_octree_file octree_file(filename);
+	voxelizer::octree_file_header const& header = octree_file.m_header;
 
-	std::ifstream input_file_stream(filename, std::ios::binary);
+	volume_size = header.m_volume_size;
+	octree_resolution = header.m_resolution;
 
-	input_file_stream.read((char*) &version, sizeof(uint32_t));
-	input_file_stream.read((char*) &volume_size, sizeof(glm::uvec3));
-	input_file_stream.read((char*) &octree_resolution, sizeof(uint32_t));
-	input_file_stream.read((char*) &octree_bytesize, sizeof(uint32_t));
+	size_t octree_bytesize = octree_file.m_node_count * sizeof(GLuint);
 
-	std::vector<char> octree_buffer_data(octree_bytesize);
-	input_file_stream.read(octree_buffer_data.data(), octree_bytesize);
-
-	printf("Octree loaded - Version: %d, Volume size: (%d, %d, %d), Resolution: %d, Bytesize: %d (~%.1f MB)\n",
-		version,
+	printf("Octree loaded - Version: %d, Volume size: (%d, %d, %d), Resolution: %d, Bytesize: %zu (~%.1f MB)\n",
+		header.m_version,
 		volume_size.x, volume_size.y, volume_size.z,
 		octree_resolution,
 		octree_bytesize,
@@ -122,10 +120,7 @@ std::pair<GLuint, size_t> load_octree_from_file(
 
 	printf("Uploading octree on a GPU buffer\n");
 
-	GLuint octree_buffer{};
-	glGenBuffers(1, &octree_buffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree_buffer);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, octree_bytesize, octree_buffer_data.data(), NULL);
+	GLuint octree_buffer = octree_file.upload();
 
 	return {
 		octree_buffer,
@@ -154,21 +149,19 @@ std::pair<GLuint, size_t> build_octree_from_scene(voxelizer::scene const& scene,
 
 	voxelize(voxel_list, scene, volume_height, scene.m_transformed_min, scene.get_transformed_size());
 
-	voxelizer::octree_builder octree_builder{};
-	GLuint octree_buffer{};
 	uint32_t octree_resolution = (uint32_t)glm::ceil(glm::log2((float) max_volume_side));
-	size_t octree_bytesize = voxelizer::octree::get_octree_bytesize(octree_resolution);
 
-	glGenBuffers(1, &octree_buffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree_buffer);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, octree_bytesize, NULL, NULL);
+	voxelizer::voxel_list_dedup voxel_list_dedup{};
+	voxel_list_dedup(voxel_list, octree_resolution);
+
+	voxelizer::octree_builder octree_builder{};
 
 	voxelizer::octree octree{};
-	octree_builder.build(voxel_list, octree_resolution, octree_buffer, 0, octree);
+	octree_builder.build(voxel_list, octree_resolution, octree);
 
 	return {
-		octree_buffer,
-		octree_bytesize,
+		octree.m_buffer,
+		octree.get_used_bytesize(),
 	};
 }
 
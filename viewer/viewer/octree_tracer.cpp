@@ -2,8 +2,6 @@
 
 #include <iostream>
 
-#include <glm/gtc/type_ptr.hpp>
-
 #include <shinji.hpp>
 
 // ------------------------------------------------------------------------------------------------ octree_tracer
@@ -45,17 +43,17 @@ void voxelizer::octree_tracer::render(
 {
 	m_program.use();
 
-	glUniform3fv(m_program.get_uniform_location("u_octree_from"), 1, glm::value_ptr(position));
-	glUniform3fv(m_program.get_uniform_location("u_octree_size"), 1, glm::value_ptr(size));
-
-	glUniform2uiv(m_program.get_uniform_location("u_screen"), 1, glm::value_ptr(screen));
-
-	// camera
-	glUniformMatrix4fv(m_program.get_uniform_location("u_projection"), 1, GL_FALSE, glm::value_ptr(camera_projection));
-	glUniformMatrix4fv(m_program.get_uniform_location("u_view"), 1, GL_FALSE, glm::value_ptr(camera_view));
-	glUniform3fv(m_program.get_uniform_location("u_position"), 1, glm::value_ptr(camera_position));
-
-	glUniform1ui(m_program.get_uniform_location("u_start_address"), starting_node_address);
+	frame_uniforms uniforms{};
+	uniforms.m_projection = camera_projection;
+	uniforms.m_view = camera_view;
+	uniforms.m_position = camera_position;
+	uniforms.m_start_address = starting_node_address;
+	uniforms.m_octree_from = position;
+	uniforms.m_octree_size = size;
+	uniforms.m_screen = screen;
+
+	m_frame_uniforms.update(uniforms);
+	m_frame_uniforms.bind(k_frame_uniforms_binding);
 
 	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, octree_buffer, octree_buffer_offset, octree_buffer_size);
 
@@ -10,8 +10,22 @@ namespace voxelizer
 	class octree_tracer
 	{
 	private:
+		struct frame_uniforms // Same layout as ubo_tracer_frame (std140), written once per frame.
+		{
+			glm::mat4 m_projection;
+			glm::mat4 m_view;
+			alignas(16) glm::vec3 m_position;
+			GLuint m_start_address;
+			alignas(16) glm::vec3 m_octree_from;
+			alignas(16) glm::vec3 m_octree_size;
+			alignas(16) glm::uvec2 m_screen;
+		};
+
+		static constexpr GLuint k_frame_uniforms_binding = 0;
+
 		program m_program;
 		screen_quad m_screen_quad;
+		voxelizer::uniform_buffer<frame_uniforms> m_frame_uniforms;
 
 	public:
 		octree_tracer();
@@ -21,6 +21,12 @@ voxelizer::scene_renderer::scene_renderer()
 	m_program.attach_shader(frag_shader);
 
 	m_program.link();
+
+	m_camera_projection_location = m_program.get_uniform_location("u_camera_projection");
+	m_camera_view_location = m_program.get_uniform_location("u_camera_view");
+	m_scene_transform_location = m_program.get_uniform_location("u_scene_transform");
+	m_transform_location = m_program.get_uniform_location("u_transform");
+	m_color_location = m_program.get_uniform_location("u_color");
 }
 
 void voxelizer::scene_renderer::scene_renderer::render(
@@ -34,22 +40,22 @@ void voxelizer::scene_renderer::scene_renderer::render(
 
 	m_program.use();
 
-	glUniformMatrix4fv(m_program.get_uniform_location("u_camera_projection"), 1, GL_FALSE, glm::value_ptr(camera_projection));
-	glUniformMatrix4fv(m_program.get_uniform_location("u_camera_view"), 1, GL_FALSE, glm::value_ptr(camera_view));
+	glUniformMatrix4fv(m_camera_projection_location, 1, GL_FALSE, glm::value_ptr(camera_projection));
+	glUniformMatrix4fv(m_camera_view_location, 1, GL_FALSE, glm::value_ptr(camera_view));
 
-	glUniformMatrix4fv(m_program.get_uniform_location("u_scene_transform"), 1, GL_FALSE, glm::value_ptr(transform));
+	glUniformMatrix4fv(m_scene_transform_location, 1, GL_FALSE, glm::value_ptr(transform));
 
 	for (auto& mesh : scene.m_meshes)
 	{
-		glUniformMatrix4fv(m_program.get_uniform_location("u_transform"), 1, GL_FALSE, glm::value_ptr(mesh.m_transform));
+		glUniformMatrix4fv(m_transform_location, 1, GL_FALSE, glm::value_ptr(mesh.m_transform));
 
-		glUniform4fv(m_program.get_uniform_location("u_color"), 1, glm::value_ptr(mesh.m_material->get_color(m_view_type)));
+		glUniform4fv(m_color_location, 1, glm::value_ptr(mesh.m_material->get_color(m_view_type)));
 		glBindTexture(GL_TEXTURE_2D, mesh.m_material->get_texture(m_view_type));
 
 		glBindVertexArray(mesh.m_vao);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_ebo);
 
-		glDrawElements(GL_TRIANGLES, mesh.m_element_count, GL_UNSIGNED_INT, NULL);
+		glDrawElements(GL_TRIANGLES, mesh.m_element_count, mesh.m_index_type, (void*) mesh.m_index_offset);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
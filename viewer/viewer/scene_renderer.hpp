@@ -10,6 +10,13 @@ namespace voxelizer
 	private:
 		program m_program;
 
+		// Resolved once after link
+		GLint m_camera_projection_location;
+		GLint m_camera_view_location;
+		GLint m_scene_transform_location;
+		GLint m_transform_location;
+		GLint m_color_location;
+
 	public:
 		material::type m_view_type = material::type::DIFFUSE; // TODO
 
@@ -4,17 +4,19 @@
 
 #define MAX_DEPTH 32
 
-uniform uvec2 u_screen;
-
-uniform vec3 u_position;
-uniform mat4 u_projection;
-uniform mat4 u_view;
+// Per-frame constants (see octree_tracer::frame_uniforms)
+layout(std140, binding = 0) uniform ubo_tracer_frame
+{
+	mat4 u_projection;
+	mat4 u_view;
+	vec3 u_position;
+	uint u_start_address; // The starting index within the octree, this is useful whether we need to render a sub-portion of the octree.
+	vec3 u_octree_from;
+	vec3 u_octree_size;
+	uvec2 u_screen;
+};
 
 layout(std430, binding = 0) buffer ssbo_octree { uint b_octree[]; };
-uniform uint u_start_address; // The starting index within the octree, this is useful whether we need to render a sub-portion of the octree.
-
-uniform vec3 u_octree_from;
-uniform vec3 u_octree_size;
 
 out vec4 f_color;
 
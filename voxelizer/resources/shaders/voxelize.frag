@@ -1,4 +1,4 @@
-#version 460
+#version 450
 
 in vec3 g_position;
 in vec3 g_normal;
@@ -6,22 +6,32 @@ in vec2 g_uv;
 in vec4 g_color;
 
 flat in int g_axis;
+flat in uint g_draw_id;
 
 layout (pixel_center_integer) in vec4 gl_FragCoord;
 
-layout(location = 6) uniform vec4 u_color;
-layout(location = 7) uniform sampler2D u_texture2d;
-
-uniform uint u_viewport;
-uniform uvec3 u_grid;
+// Per-pass constants, same block in all the stages (see voxelize::pass_uniforms)
+layout(std140, binding = 0) uniform ubo_voxelize_pass
+{
+	mat4 u_transform;
+	mat4 u_x_ortho_projection;
+	mat4 u_y_ortho_projection;
+	mat4 u_z_ortho_projection;
+	uvec3 u_grid;
+	uint u_viewport;
+};
 
-uniform uint u_can_store;
+layout(location = 7) uniform sampler2D u_texture2d;
+layout(location = 8) uniform uint u_capacity; // The voxels that fit the voxel-list, the ones past it are only counted.
 
-layout(binding = 1, rgb10_a2ui) uniform uimageBuffer u_voxel_list_position;
+layout(binding = 1, rg32ui) uniform uimageBuffer u_voxel_list_position; // 64-bit Morton codes (low, high)
 layout(binding = 2, rgba8) uniform imageBuffer u_voxel_list_color;
 layout(binding = 3) uniform atomic_uint u_voxels_count;
 layout(binding = 4) uniform atomic_uint atomic_errors_counter;
 
+layout(std430, binding = 5) buffer ssbo_draw_voxels { uint b_draw_voxels[]; }; // Voxels generated by every batched draw.
+layout(location = 10) uniform bool u_count_draw_voxels;
+
 void assert(bool test)
 {
 	if (!test) {
@@ -34,12 +44,38 @@ bool is_inside_grid(uvec3 pos)
 	return pos.x < u_grid.x && pos.y < u_grid.y && pos.z < u_grid.z;
 }
 
+uint spread_bits_10(uint v)
+{
+	v &= 0x3ffu;
+	v = (v | (v << 16u)) & 0xff0000ffu;
+	v = (v | (v << 8u)) & 0x0300f00fu;
+	v = (v | (v << 4u)) & 0x030c30c3u;
+	v = (v | (v << 2u)) & 0x09249249u;
+	return v;
+}
+
+// Interleaves 21 bits per axis (x, y, z from the LSB) into a 64-bit Morton code, stored as (low, high).
+uvec2 encode_morton(uvec3 pos)
+{
+	uvec2 morton;
+	morton.x =
+		spread_bits_10(pos.x) | (spread_bits_10(pos.y) << 1u) | (spread_bits_10(pos.z) << 2u) |
+		(((pos.x >> 10u) & 1u) << 30u) | (((pos.y >> 10u) & 1u) << 31u);
+	morton.y =
+		((pos.z >> 10u) & 1u) |
+		(spread_bits_10(pos.x >> 11u) << 1u) | (spread_bits_10(pos.y >> 11u) << 2u) | (spread_bits_10(pos.z >> 11u) << 3u);
+	return morton;
+}
+
 void push_voxel(uvec3 pos, vec4 col)
 {
 	uint loc = atomicCounterIncrement(u_voxels_count);
-	if (u_can_store == 1)
+	if (u_count_draw_voxels)
+		atomicAdd(b_draw_voxels[g_draw_id], 1u);
+
+	if (loc < u_capacity)
 	{
-		imageStore(u_voxel_list_position, int(loc), uvec4(pos, 0));
+		imageStore(u_voxel_list_position, int(loc), uvec4(encode_morton(pos), 0, 0));
 		imageStore(u_voxel_list_color, int(loc), col);
 	}
 }
@@ -66,7 +102,7 @@ void main()
 
 	// TODO color could be calculated better
 	// TODO uv y is inverted
-	vec4 col = g_color * u_color * texture(u_texture2d, vec2(g_uv.x, 1 - g_uv.y));
+	vec4 col = g_color * texture(u_texture2d, vec2(g_uv.x, 1 - g_uv.y));
 
 	if (is_inside_grid(pos))
 	{
@@ -1,24 +1,51 @@
-#version 460
+#version 450
 
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 uv;
 layout(location = 3) in vec4 color;
+layout(location = 4) in uint draw_id; // Only for batched draws (one per instance, offset by the baseInstance).
 
-uniform mat4 u_mesh_transform;
-uniform mat4 u_transform;
+struct draw
+{
+	mat4 transform;
+	vec4 color;
+};
+
+layout(std430, binding = 6) readonly buffer ssbo_draws { draw b_draws[]; };
+
+// Per-pass constants, same block in all the stages (see voxelize::pass_uniforms)
+layout(std140, binding = 0) uniform ubo_voxelize_pass
+{
+	mat4 u_transform;
+	mat4 u_x_ortho_projection;
+	mat4 u_y_ortho_projection;
+	mat4 u_z_ortho_projection;
+	uvec3 u_grid;
+	uint u_viewport;
+};
+
+// Per-draw state, at explicit locations (see voxelize::uniform_location)
+layout(location = 5) uniform mat4 u_mesh_transform;
+layout(location = 6) uniform vec4 u_color;
+layout(location = 9) uniform bool u_batched;
 
 out vec3 v_position;
 out vec3 v_normal;
 out vec2 v_uv;
 out vec4 v_color;
+flat out uint v_draw_id;
 
 void main()
 {
-    gl_Position = u_transform * u_mesh_transform * vec4(position, 1);
+	mat4 mesh_transform = u_batched ? b_draws[draw_id].transform : u_mesh_transform;
+	vec4 mesh_color = u_batched ? b_draws[draw_id].color : u_color;
+
+    gl_Position = u_transform * mesh_transform * vec4(position, 1);
 
 	v_position = gl_Position.xyz;
 	v_normal = normal;
 	v_uv = uv;
-	v_color = color;
+	v_color = color * mesh_color;
+	v_draw_id = u_batched ? draw_id : 0;
 }
@@ -1,5 +1,14 @@
 #include "ai_scene_loader.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
 #include <glm/gtc/type_ptr.hpp>
 
 #include <assimp/scene.h>
@@ -11,6 +20,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include "gl.hpp"
+#include "parallel.hpp"
+#include "scene_cache.hpp"
+
 // ------------------------------------------------------------------------------------------------
 // voxelizer::mesh
 // ------------------------------------------------------------------------------------------------
@@ -107,11 +120,9 @@ void load_color_vbo(voxelizer::mesh& mesh, aiMesh const& ai_mesh)
 	glBindVertexArray(0);
 }
 
-void load_ebo(voxelizer::mesh& mesh, aiMesh const& ai_mesh)
+void load_indices(std::vector<GLuint>& indices, aiMesh const& ai_mesh)
 {
-	mesh.m_element_count = size_t(ai_mesh.mNumFaces) * 3;
-
-	GLuint* indices = new GLuint[mesh.m_element_count];
+	indices.resize(size_t(ai_mesh.mNumFaces) * 3);
 
 	for (size_t i = 0; i < ai_mesh.mNumFaces; i++)
 	{
@@ -124,13 +135,53 @@ void load_ebo(voxelizer::mesh& mesh, aiMesh const& ai_mesh)
 		indices[i * 3 + 1] = face.mIndices[1];
 		indices[i * 3 + 2] = face.mIndices[2];
 	}
+}
 
+void load_ebo(voxelizer::mesh& mesh, std::vector<GLuint> const& indices)
+{
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.m_element_count * sizeof(GLuint), indices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, NULL);
 }
 
+void load_host_geometry(voxelizer::mesh& mesh, aiMesh const& ai_mesh)
+{
+	mesh.m_positions.resize(ai_mesh.mNumVertices);
+	for (size_t i = 0; i < ai_mesh.mNumVertices; i++)
+	{
+		mesh.m_positions[i] = glm::vec3(ai_mesh.mVertices[i].x, ai_mesh.mVertices[i].y, ai_mesh.mVertices[i].z);
+	}
+
+	if (ai_mesh.HasNormals())
+	{
+		mesh.m_normals.resize(ai_mesh.mNumVertices);
+		for (size_t i = 0; i < ai_mesh.mNumVertices; i++)
+		{
+			mesh.m_normals[i] = glm::vec3(ai_mesh.mNormals[i].x, ai_mesh.mNormals[i].y, ai_mesh.mNormals[i].z);
+		}
+	}
+
+	if (ai_mesh.HasTextureCoords(0))
+	{
+		mesh.m_uvs.resize(ai_mesh.mNumVertices);
+		for (size_t i = 0; i < ai_mesh.mNumVertices; i++)
+		{
+			mesh.m_uvs[i] = glm::vec2(ai_mesh.mTextureCoords[0][i].x, ai_mesh.mTextureCoords[0][i].y);
+		}
+	}
+
+	if (ai_mesh.HasVertexColors(voxelizer::mesh::attribute::COLOR))
+	{
+		mesh.m_colors.resize(ai_mesh.mNumVertices);
+		for (size_t i = 0; i < ai_mesh.mNumVertices; i++)
+		{
+			aiColor4D const& color = ai_mesh.mColors[0][i];
+			mesh.m_colors[i] = glm::vec4(color.r, color.g, color.b, color.a);
+		}
+	}
+}
+
 void calc_transformed_min_max(voxelizer::mesh& mesh, aiMesh const& ai_mesh)
 {
 	mesh.m_transformed_min = glm::vec3(std::numeric_limits<float>::infinity());
@@ -146,19 +197,33 @@ void calc_transformed_min_max(voxelizer::mesh& mesh, aiMesh const& ai_mesh)
 	}
 }
 
-voxelizer::mesh load_mesh(aiMesh const& ai_mesh, aiMatrix4x4 const& ai_transform)
+voxelizer::mesh load_mesh(voxelizer::assimp_scene_loader const& loader, aiMesh const& ai_mesh, aiMatrix4x4 const& ai_transform)
 {
-	voxelizer::mesh mesh{};
+	voxelizer::mesh mesh(loader.m_upload_to_gpu);
 
 	mesh.m_triangle_count = ai_mesh.mNumFaces;
+	mesh.m_element_count = size_t(ai_mesh.mNumFaces) * 3;
+	mesh.m_vertex_count = ai_mesh.mNumVertices;
 	mesh.m_transform = glm::transpose(glm::make_mat4(ai_transform[0]));
 
-	load_position_vbo(mesh, ai_mesh);
-	load_normal_vbo(mesh, ai_mesh);
-	load_color_vbo(mesh, ai_mesh);
-	load_uv_vbo(mesh, ai_mesh);
+	std::vector<GLuint> indices{};
+	load_indices(indices, ai_mesh);
+
+	if (loader.m_upload_to_gpu)
+	{
+		load_position_vbo(mesh, ai_mesh);
+		load_normal_vbo(mesh, ai_mesh);
+		load_color_vbo(mesh, ai_mesh);
+		load_uv_vbo(mesh, ai_mesh);
 
-	load_ebo(mesh, ai_mesh);
+		load_ebo(mesh, indices);
+	}
+
+	if (loader.m_keep_host_data)
+	{
+		load_host_geometry(mesh, ai_mesh);
+		mesh.m_indices = std::move(indices);
+	}
 
 	calc_transformed_min_max(mesh, ai_mesh);
 
@@ -169,107 +234,328 @@ voxelizer::mesh load_mesh(aiMesh const& ai_mesh, aiMatrix4x4 const& ai_transform
 // voxelizer::material
 // ================================================================================================================================
 
-void load_material_texture(
+void store_host_image(voxelizer::material::image& image, int width, int height, int channels, stbi_uc const* image_data)
+{
+	image.m_width = width;
+	image.m_height = height;
+	image.m_data.resize(size_t(width) * height * 4);
+
+	for (size_t i = 0; i < size_t(width) * height; i++)
+	{
+		stbi_uc const* src = image_data + i * channels;
+		uint8_t* dst = image.m_data.data() + i * 4;
+
+		if (channels < 3) // Grey (+ alpha)
+		{
+			dst[0] = dst[1] = dst[2] = src[0];
+			dst[3] = channels == 2 ? src[1] : 255;
+		}
+		else
+		{
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = channels == 4 ? src[3] : 255;
+		}
+	}
+}
+
+// A texture referenced by the materials, decoded by the texture_decoder and then uploaded on the GL thread
+struct pending_texture
+{
+	std::shared_ptr<voxelizer::material::texture> m_texture;
+	std::string m_name;                 // As referenced by the material, for the logs.
+	std::filesystem::path m_path;       // The external file, if not embedded.
+	aiTexture const* m_embedded = nullptr;
+
+	// Set by the decoding threads
+	stbi_uc* m_data = nullptr;
+	int m_width = 0, m_height = 0, m_channels = 0;
+};
+
+// The textures and materials already loaded, so that the meshes sharing them don't decode them again
+struct load_cache
+{
+	std::vector<std::shared_ptr<voxelizer::material>> m_materials; // By aiScene material index, loaded on first use.
+	std::unordered_map<std::string, std::shared_ptr<voxelizer::material::texture>> m_textures; // By file path, "*<index>" if embedded.
+	std::shared_ptr<voxelizer::material::texture> m_white_texture; // For the slots without (or not loading) a texture.
+
+	std::vector<pending_texture> m_pending_textures; // Created with their GL object, not decoded yet.
+};
+
+void set_texture_parameters()
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+std::shared_ptr<voxelizer::material::texture> const& get_white_texture(voxelizer::assimp_scene_loader const& loader, load_cache& cache)
+{
+	if (cache.m_white_texture)
+		return cache.m_white_texture;
+
+	cache.m_white_texture = std::make_shared<voxelizer::material::texture>(loader.m_upload_to_gpu);
+
+	if (loader.m_upload_to_gpu)
+	{
+		glBindTexture(GL_TEXTURE_2D, cache.m_white_texture->m_name);
+
+		GLfloat empty_image[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_FLOAT, empty_image);
+
+		set_texture_parameters();
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	if (loader.m_keep_host_data)
+	{
+		stbi_uc empty_image[4] = { 255, 255, 255, 255 };
+		store_host_image(cache.m_white_texture->m_image, 1, 1, 4, empty_image);
+	}
+
+	return cache.m_white_texture;
+}
+
+/// Returns the texture of the material slot. New textures are only created here, their image is decoded (in parallel)
+/// and uploaded afterwards, see texture_decoder.
+std::shared_ptr<voxelizer::material::texture> load_material_texture(
+	voxelizer::assimp_scene_loader const& loader,
 	aiScene const& ai_scene,
-	GLuint const& texture,
+	load_cache& cache,
 	aiTextureType texture_type,
 	std::filesystem::path const& folder,
 	aiMaterial const* ai_material
 )
 {
-	glBindTexture(GL_TEXTURE_2D, texture);
-
 	aiString path{};
-	if (aiGetMaterialTexture(ai_material, texture_type, 0, &path) == aiReturn_SUCCESS && path.length > 0)
+	if (aiGetMaterialTexture(ai_material, texture_type, 0, &path) != aiReturn_SUCCESS || path.length == 0)
+		return get_white_texture(loader, cache);
+
+	bool is_embedded = path.C_Str()[0] == '*';
+	std::filesystem::path texture_path = folder / path.C_Str();
+
+	std::string key = is_embedded ? std::string(path.C_Str()) : texture_path.u8string();
+
+	auto found = cache.m_textures.find(key);
+	if (found != cache.m_textures.end())
+		return found->second;
+
+	pending_texture pending{};
+	pending.m_texture = std::make_shared<voxelizer::material::texture>(loader.m_upload_to_gpu);
+	pending.m_name = path.C_Str();
+
+	if (is_embedded)
+		pending.m_embedded = ai_scene.mTextures[std::atoi(path.C_Str() + 1)];
+	else
+		pending.m_path = texture_path;
+
+	cache.m_pending_textures.push_back(pending);
+	cache.m_textures.emplace(key, pending.m_texture);
+
+	return pending.m_texture;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Texture decoding
+// ------------------------------------------------------------------------------------------------
+
+void decode_texture(voxelizer::assimp_scene_loader const& loader, pending_texture& pending)
+{
+	int comp;
+
+	if (pending.m_embedded != nullptr)
 	{
-		int width, height, comp;
-		stbi_uc* image_data{};
+		aiTexture const* ai_texture = pending.m_embedded;
 
-		if (path.C_Str()[0] == '*') // Embedded
-		{
-			int32_t texture_id = std::atoi(path.C_Str() + 1);
-			aiTexture* ai_texture = ai_scene.mTextures[texture_id];
+		printf("[assimp_scene_loader] Embedded texture %s (width=%d, height=%d)\n", pending.m_name.c_str(), ai_texture->mWidth, ai_texture->mHeight);
 
-			printf("[assimp_scene_loader] Embedded texture %d (width=%d, height=%d)\n", texture_id, ai_texture->mWidth, ai_texture->mHeight);
+		size_t texture_size = ai_texture->mWidth * (ai_texture->mHeight > 0 ? ai_texture->mHeight : 1);
+		pending.m_data = stbi_load_from_memory(reinterpret_cast<unsigned char const*>(ai_texture->pcData), texture_size, &pending.m_width, &pending.m_height, &comp, 0);
+		pending.m_channels = comp;
+	}
+	else // External file
+	{
+		printf("[assimp_scene_loader] Loading external texture at \"%s\"\n", pending.m_path.u8string().c_str());
 
-			size_t texture_size = ai_texture->mWidth * (ai_texture->mHeight > 0 ? ai_texture->mHeight : 1);
-			image_data = stbi_load_from_memory(reinterpret_cast<unsigned char*>(ai_texture->pcData), texture_size, &width, &height, &comp, 0);
-		}
-		else // External file
-		{
-			std::filesystem::path texture_path = folder / path.C_Str();
+		pending.m_data = stbi_load(pending.m_path.u8string().c_str(), &pending.m_width, &pending.m_height, &comp, STBI_rgb);
+		pending.m_channels = STBI_rgb; // stb_image reports the channels of the file, not the requested ones
+	}
 
-			printf("[assimp_scene_loader] Loading external texture at \"%s\"\n", texture_path.u8string().c_str());
+	if (pending.m_data != nullptr && loader.m_keep_host_data)
+	{
+		store_host_image(pending.m_texture->m_image, pending.m_width, pending.m_height, pending.m_channels, pending.m_data);
+	}
+}
 
-			image_data = stbi_load((folder / path.C_Str()).u8string().c_str(), &width, &height, &comp, STBI_rgb);
-		}
+/// Decodes the pending textures on a pool of threads, while the caller goes on loading the meshes. The decoded textures
+/// are handed back (in completion order) through `wait_next`.
+class texture_decoder
+{
+public:
+	texture_decoder(voxelizer::assimp_scene_loader const& loader, std::vector<pending_texture>& pending_textures) :
+		m_pending_textures(pending_textures)
+	{
+		uint32_t thread_count = (uint32_t) std::min<size_t>(voxelizer::get_thread_count(loader.m_thread_count), pending_textures.size());
 
-		if (image_data == nullptr)
+		// Threads pick the next texture when done, rather than a fixed range, as texture sizes vary a lot
+		m_thread = std::thread([this, &loader, thread_count]
 		{
-			fprintf(stderr, "[assimp_scene_loader] Failed to load texture \"%s\"\n", path.C_Str());
-			fflush(stderr);
+			voxelizer::parallel_for(thread_count, thread_count, [&](size_t, size_t, uint32_t)
+			{
+				size_t idx;
+				while (!m_aborted && (idx = m_next++) < m_pending_textures.size())
+				{
+					decode_texture(loader, m_pending_textures[idx]);
+
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_decoded.push_back(idx);
+					m_condition.notify_one();
+				}
+			});
+		});
+	}
 
-			throw std::runtime_error("Failed to load texture");
-		}
+	texture_decoder(texture_decoder const&) = delete;
 
-		if (comp == 3)
-		{
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
-		}
-		else if (comp == 4)
+	~texture_decoder()
+	{
+		m_aborted = true;
+		m_thread.join();
+
+		for (pending_texture& pending : m_pending_textures)
 		{
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
+			if (pending.m_data != nullptr)
+				stbi_image_free(pending.m_data);
+			pending.m_data = nullptr;
 		}
+	}
 
-		stbi_image_free(image_data);
+	/// Blocks until a texture is decoded and returns its index, the textures are returned once each.
+	size_t wait_next()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [this] { return m_returned_count < m_decoded.size(); });
+
+		return m_decoded[m_returned_count++];
 	}
+
+private:
+	std::vector<pending_texture>& m_pending_textures;
+
+	std::atomic<size_t> m_next{0};
+	std::atomic<bool> m_aborted{false};
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::vector<size_t> m_decoded;
+	size_t m_returned_count = 0;
+
+	std::thread m_thread;
+};
+
+/// Uploads the decoded image, through a slot of the staging ring if it fits one.
+void upload_texture(pending_texture const& pending, voxelizer::staging_ring& staging_ring)
+{
+	GLenum format;
+	if (pending.m_channels == 3)
+		format = GL_RGB;
+	else if (pending.m_channels == 4)
+		format = GL_RGBA;
 	else
+		return; // Not supported, the texture stays incomplete
+
+	size_t size = size_t(pending.m_width) * pending.m_height * pending.m_channels;
+
+	glBindTexture(GL_TEXTURE_2D, pending.m_texture->m_name);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // stb_image rows are tightly packed
+
+	if (size <= staging_ring.m_slot_size)
 	{
-		GLfloat empty_image[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_FLOAT, empty_image);
+		size_t offset = staging_ring.acquire();
+		std::memcpy(staging_ring.m_mapped + offset, pending.m_data, size);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging_ring.m_name);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, pending.m_width, pending.m_height, 0, format, GL_UNSIGNED_BYTE, (void*) offset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		staging_ring.release();
+	}
+	else
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, format, pending.m_width, pending.m_height, 0, format, GL_UNSIGNED_BYTE, pending.m_data);
 	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
+	set_texture_parameters();
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// ------------------------------------------------------------------------------------------------
+// Material
+// ------------------------------------------------------------------------------------------------
+
+void load_material_slot(
+	voxelizer::assimp_scene_loader const& loader,
+	aiScene const& ai_scene,
+	load_cache& cache,
+	voxelizer::material& material,
+	voxelizer::material::type type,
+	aiTextureType texture_type,
+	std::filesystem::path const& folder,
+	aiMaterial const* ai_material
+)
+{
+	// The slots that aren't sampled aren't decoded at all
+	if (loader.m_texture_types & (1u << type))
+		material.set_texture(type, load_material_texture(loader, ai_scene, cache, texture_type, folder, ai_material));
+	else
+		material.set_texture(type, get_white_texture(loader, cache));
+}
+
 void load_material_color(glm::vec4& color, const char* key, unsigned int type, unsigned int index, const aiMaterial* ai_material)
 {
 	if (aiGetMaterialColor(ai_material, key, type, index, (aiColor4D*) &color[0]) != aiReturn_SUCCESS)
 		color = glm::vec4(0);
 }
 
-std::shared_ptr<voxelizer::material> load_material(
+std::shared_ptr<voxelizer::material> const& load_material(
+	voxelizer::assimp_scene_loader const& loader,
 	aiScene const& ai_scene,
+	load_cache& cache,
 	std::filesystem::path const& folder,
-	aiMaterial const* ai_material
+	uint32_t material_idx
 )
 {
-	std::shared_ptr<voxelizer::material> material = std::make_shared<voxelizer::material>();
+	std::shared_ptr<voxelizer::material>& material = cache.m_materials[material_idx];
+	if (material)
+		return material;
+
+	aiMaterial const* ai_material = ai_scene.mMaterials[material_idx];
+
+	material = std::make_shared<voxelizer::material>(false);
 	voxelizer::material::type type{};
-	
+
 	type = voxelizer::material::type::NONE;
-	load_material_texture(ai_scene, material->get_texture(type), aiTextureType_NONE, folder, ai_material);
+	load_material_slot(loader, ai_scene, cache, *material, type, aiTextureType_NONE, folder, ai_material);
 	material->get_color(type) = glm::vec4(1);
 
 	type = voxelizer::material::type::DIFFUSE;
-	load_material_texture(ai_scene, material->get_texture(type), aiTextureType_DIFFUSE, folder, ai_material);
+	load_material_slot(loader, ai_scene, cache, *material, type, aiTextureType_DIFFUSE, folder, ai_material);
 	load_material_color(material->get_color(type), AI_MATKEY_COLOR_DIFFUSE, ai_material);
 
 	type = voxelizer::material::type::AMBIENT;
-	load_material_texture(ai_scene, material->get_texture(type), aiTextureType_AMBIENT, folder, ai_material);
+	load_material_slot(loader, ai_scene, cache, *material, type, aiTextureType_AMBIENT, folder, ai_material);
 	load_material_color(material->get_color(type), AI_MATKEY_COLOR_AMBIENT, ai_material);
 
 	type = voxelizer::material::type::SPECULAR;
-	load_material_texture(ai_scene, material->get_texture(type), aiTextureType_SPECULAR, folder, ai_material);
+	load_material_slot(loader, ai_scene, cache, *material, type, aiTextureType_SPECULAR, folder, ai_material);
 	load_material_color(material->get_color(type), AI_MATKEY_COLOR_SPECULAR, ai_material);
 
 	type = voxelizer::material::type::EMISSIVE;
-	load_material_texture(ai_scene, material->get_texture(type), aiTextureType_EMISSIVE, folder, ai_material);
+	load_material_slot(loader, ai_scene, cache, *material, type, aiTextureType_EMISSIVE, folder, ai_material);
 	load_material_color(material->get_color(type), AI_MATKEY_COLOR_EMISSIVE, ai_material);
 
 	return material;
@@ -279,7 +565,15 @@ std::shared_ptr<voxelizer::material> load_material(
 // Node
 // ------------------------------------------------------------------------------------------------
 
-void load_node(voxelizer::scene& scene, aiScene const& ai_scene, const std::filesystem::path& folder, aiMatrix4x4 ai_transform, const aiNode* ai_node)
+void load_node(
+	voxelizer::assimp_scene_loader const& loader,
+	load_cache& cache,
+	voxelizer::scene& scene,
+	aiScene const& ai_scene,
+	const std::filesystem::path& folder,
+	aiMatrix4x4 ai_transform,
+	const aiNode* ai_node
+)
 {
 	ai_transform *= ai_node->mTransformation;
 
@@ -287,8 +581,8 @@ void load_node(voxelizer::scene& scene, aiScene const& ai_scene, const std::file
 	{
 		auto ai_mesh = ai_scene.mMeshes[ai_node->mMeshes[i]];
 
-		voxelizer::mesh mesh = load_mesh(*ai_mesh, ai_transform);
-		mesh.m_material = load_material(ai_scene, folder, ai_scene.mMaterials[ai_mesh->mMaterialIndex]);
+		voxelizer::mesh mesh = load_mesh(loader, *ai_mesh, ai_transform);
+		mesh.m_material = load_material(loader, ai_scene, cache, folder, ai_mesh->mMaterialIndex);
 
 		scene.m_transformed_min = glm::min(scene.m_transformed_min, mesh.m_transformed_min);
 		scene.m_transformed_max = glm::max(scene.m_transformed_max, mesh.m_transformed_max);
@@ -298,7 +592,7 @@ void load_node(voxelizer::scene& scene, aiScene const& ai_scene, const std::file
 
 	for (size_t i = 0; i < ai_node->mNumChildren; i++)
 	{
-		load_node(scene, ai_scene, folder, ai_transform, ai_node->mChildren[i]);
+		load_node(loader, cache, scene, ai_scene, folder, ai_transform, ai_node->mChildren[i]);
 	}
 }
 
@@ -310,7 +604,7 @@ voxelizer::assimp_scene_loader::assimp_scene_loader()
 {
 }
 
-void voxelizer::assimp_scene_loader::load(scene& scene, std::filesystem::path const& path)
+void import_scene(voxelizer::assimp_scene_loader const& loader, voxelizer::scene& scene, std::filesystem::path const& path)
 {
 	Assimp::Importer importer;
 	aiScene const* ai_scene = importer.ReadFile(path.u8string(), aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
@@ -318,5 +612,102 @@ void voxelizer::assimp_scene_loader::load(scene& scene, std::filesystem::path co
 	scene.m_transformed_min = glm::vec3(std::numeric_limits<float>::infinity());
 	scene.m_transformed_max = glm::vec3(-std::numeric_limits<float>::infinity());
 
-	load_node(scene, *ai_scene, path.parent_path(), aiMatrix4x4(),  ai_scene->mRootNode);
+	load_cache cache{};
+	cache.m_materials.resize(ai_scene->mNumMaterials);
+
+	// The materials are loaded first, so that their textures decode while the meshes are loaded
+	for (uint32_t i = 0; i < ai_scene->mNumMeshes; i++)
+		load_material(loader, *ai_scene, cache, path.parent_path(), ai_scene->mMeshes[i]->mMaterialIndex);
+
+	{
+		texture_decoder texture_decoder(loader, cache.m_pending_textures);
+
+		load_node(loader, cache, scene, *ai_scene, path.parent_path(), aiMatrix4x4(),  ai_scene->mRootNode);
+
+		std::unique_ptr<voxelizer::staging_ring> staging_ring;
+		if (loader.m_upload_to_gpu && !cache.m_pending_textures.empty())
+		{
+			staging_ring = std::make_unique<voxelizer::staging_ring>(
+				voxelizer::assimp_scene_loader::k_texture_staging_slot_size,
+				voxelizer::assimp_scene_loader::k_texture_staging_slot_count
+			);
+		}
+
+		for (size_t i = 0; i < cache.m_pending_textures.size(); i++)
+		{
+			pending_texture& pending = cache.m_pending_textures[texture_decoder.wait_next()];
+
+			if (pending.m_data == nullptr)
+			{
+				fprintf(stderr, "[assimp_scene_loader] Failed to load texture \"%s\"\n", pending.m_name.c_str());
+				fflush(stderr);
+
+				throw std::runtime_error("Failed to load texture");
+			}
+
+			if (loader.m_upload_to_gpu)
+				upload_texture(pending, *staging_ring);
+
+			stbi_image_free(pending.m_data);
+			pending.m_data = nullptr;
+		}
+	}
+
+	size_t material_count = std::count_if(cache.m_materials.begin(), cache.m_materials.end(), [](auto const& material) { return material != nullptr; });
+	printf("[assimp_scene_loader] Loaded %zu meshes, materials: %zu, textures: %zu\n", scene.m_meshes.size(), material_count, cache.m_textures.size());
+}
+
+void voxelizer::assimp_scene_loader::load(scene& scene, std::filesystem::path const& path)
+{
+	if (m_cache_folder.empty())
+	{
+		import_scene(*this, scene, path);
+		return;
+	}
+
+	// The key also covers the options changing what is loaded
+	uint64_t cache_key = (voxelizer::hash_file(path) ^ m_texture_types) * 0x100000001b3;
+
+	char cache_name[32];
+	snprintf(cache_name, sizeof(cache_name), ".%016llx.vxscene", (unsigned long long) cache_key);
+
+	std::filesystem::path cache_path = m_cache_folder / (path.filename().u8string() + cache_name);
+
+	if (voxelizer::read_scene_cache(cache_path, cache_key, scene, m_upload_to_gpu, m_keep_host_data))
+		return;
+
+	// The cache is written from the host-side copy of the scene, dropped afterwards if it wasn't requested
+	assimp_scene_loader loader = *this;
+	loader.m_keep_host_data = true;
+
+	import_scene(loader, scene, path);
+
+	try
+	{
+		std::filesystem::create_directories(m_cache_folder);
+		voxelizer::write_scene_cache(cache_path, cache_key, scene);
+	}
+	catch (std::exception const& exception)
+	{
+		fprintf(stderr, "[assimp_scene_loader] Failed to write the scene cache: %s\n", exception.what());
+		fflush(stderr);
+	}
+
+	if (!m_keep_host_data)
+	{
+		for (voxelizer::mesh& mesh : scene.m_meshes)
+		{
+			mesh.m_positions = {};
+			mesh.m_normals = {};
+			mesh.m_uvs = {};
+			mesh.m_colors = {};
+			mesh.m_indices = {};
+
+			for (uint32_t type = 0; type < material::type::Count; type++)
+			{
+				if (auto const& texture = mesh.m_material->get_shared_texture((material::type) type))
+					texture->m_image = {};
+			}
+		}
+	}
 }
@@ -10,6 +10,24 @@ namespace voxelizer
 	class assimp_scene_loader
 	{
 	public:
+		bool m_upload_to_gpu = true;   // Creates the GL objects (VAO, VBOs, textures) needed by the GPU backend.
+		bool m_keep_host_data = false; // Keeps a host-side copy of the geometry and of the textures, needed by the CPU backend.
+
+		/// The material slots (bits of material::type) whose textures are decoded, the voxelizers only sample DIFFUSE.
+		/// The other slots get a white texel. Textures and materials are decoded once, however many meshes share them.
+		uint32_t m_texture_types = 1u << material::type::DIFFUSE;
+
+		/// The threads decoding the textures (while the meshes are loaded), 0 means all the hardware threads. The decoded
+		/// textures are uploaded through a ring of persistent-mapped PBOs, those larger than a slot are uploaded directly.
+		uint32_t m_thread_count = 0;
+
+		static constexpr size_t k_texture_staging_slot_size = 16 << 20; // An RGBA 2048x2048 texture.
+		static constexpr uint32_t k_texture_staging_slot_count = 3;
+
+		/// If set, the loaded scenes are cached there (see scene_cache.hpp), keyed by the hash of the source file. Later loads
+		/// of the same file map the cache instead of importing it again. The external textures aren't part of the key.
+		std::filesystem::path m_cache_folder;
+
 		assimp_scene_loader();
 
 		void load(scene& scene, std::filesystem::path const& path);
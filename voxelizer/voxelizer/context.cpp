@@ -0,0 +1,245 @@
+#include "context.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#ifdef VOXELIZER_EGL
+	#include <EGL/egl.h>
+	#include <EGL/eglext.h>
+#endif
+
+voxelizer::context::context(context_api api) :
+	m_api(api)
+{
+	if (!is_supported(api))
+		throw std::invalid_argument("Context API not supported by this build");
+
+	try
+	{
+		switch (api)
+		{
+		case context_api::GLFW: create_glfw(); break;
+		case context_api::EGL:  create_egl();  break;
+		}
+	}
+	catch (...)
+	{
+		destroy();
+		throw;
+	}
+}
+
+voxelizer::context::~context()
+{
+	destroy();
+}
+
+void voxelizer::context::destroy()
+{
+	if (m_window)
+	{
+		glfwDestroyWindow((GLFWwindow*) m_window);
+		glfwTerminate();
+
+		m_window = nullptr;
+	}
+
+#ifdef VOXELIZER_EGL
+	if (m_egl_display)
+	{
+		eglMakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+		if (m_egl_context)
+			eglDestroyContext(m_egl_display, m_egl_context);
+
+		eglTerminate(m_egl_display);
+
+		m_egl_display = nullptr;
+		m_egl_context = nullptr;
+	}
+#endif
+}
+
+void voxelizer::context::make_current()
+{
+	if (m_window)
+		glfwMakeContextCurrent((GLFWwindow*) m_window);
+
+#ifdef VOXELIZER_EGL
+	if (m_egl_context)
+		eglMakeCurrent(m_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_egl_context);
+#endif
+}
+
+bool voxelizer::context::is_supported(context_api api)
+{
+	switch (api)
+	{
+	case context_api::GLFW:
+		return true;
+	case context_api::EGL:
+#ifdef VOXELIZER_EGL
+		return true;
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+voxelizer::context_api voxelizer::context::get_default_api()
+{
+	return is_supported(context_api::EGL) ? context_api::EGL : context_api::GLFW;
+}
+
+// ------------------------------------------------------------------------------------------------
+// GLFW
+// ------------------------------------------------------------------------------------------------
+
+void voxelizer::context::create_glfw()
+{
+	if (glfwInit() != GLFW_TRUE)
+		throw std::runtime_error("Failed to initialize GLFW");
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(23, 23 /* We don't care about window dimension */, "voxelizer", nullptr, nullptr);
+	if (window == nullptr)
+	{
+		glfwTerminate();
+		throw std::runtime_error("Failed to create the GLFW window");
+	}
+
+	m_window = window;
+
+	glfwMakeContextCurrent((GLFWwindow*) m_window);
+
+	if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress))
+		throw std::runtime_error("Failed to initialize GLAD");
+}
+
+// ------------------------------------------------------------------------------------------------
+// EGL
+// ------------------------------------------------------------------------------------------------
+
+#ifdef VOXELIZER_EGL
+
+bool has_egl_extension(char const* extensions, char const* extension)
+{
+	if (extensions == nullptr)
+		return false;
+
+	size_t length = strlen(extension);
+	for (char const* at = strstr(extensions, extension); at != nullptr; at = strstr(at + length, extension))
+	{
+		bool starts = at == extensions || at[-1] == ' ';
+		bool ends = at[length] == ' ' || at[length] == '\0';
+		if (starts && ends)
+			return true;
+	}
+	return false;
+}
+
+EGLDisplay get_egl_display()
+{
+	// Client extensions, can be queried without a display (EGL_EXT_client_extensions)
+	char const* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+	auto eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (eglGetPlatformDisplayEXT && has_egl_extension(client_extensions, "EGL_EXT_platform_base"))
+	{
+		// Mesa: surfaceless platform, doesn't need any window system (also works with llvmpipe)
+		if (has_egl_extension(client_extensions, "EGL_MESA_platform_surfaceless"))
+		{
+			EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+			if (display != EGL_NO_DISPLAY)
+				return display;
+		}
+
+		// NVIDIA and others: pick the first device
+		if (has_egl_extension(client_extensions, "EGL_EXT_platform_device"))
+		{
+			auto eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+
+			EGLDeviceEXT device{};
+			EGLint device_count = 0;
+			if (eglQueryDevicesEXT && eglQueryDevicesEXT(1, &device, &device_count) && device_count > 0)
+			{
+				EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+				if (display != EGL_NO_DISPLAY)
+					return display;
+			}
+		}
+	}
+
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+void voxelizer::context::create_egl()
+{
+	EGLDisplay display = get_egl_display();
+	if (display == EGL_NO_DISPLAY)
+		throw std::runtime_error("Failed to get an EGL display");
+
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor))
+		throw std::runtime_error("Failed to initialize EGL, error: " + std::to_string(eglGetError()));
+
+	m_egl_display = display;
+
+	char const* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if (!has_egl_extension(extensions, "EGL_KHR_surfaceless_context"))
+		throw std::runtime_error("EGL_KHR_surfaceless_context not supported");
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+		throw std::runtime_error("Failed to bind the OpenGL API, error: " + std::to_string(eglGetError()));
+
+	// The context is never presented, a config is only needed if the implementation requires one
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	if (!has_egl_extension(extensions, "EGL_KHR_no_config_context"))
+	{
+		EGLint const config_attributes[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+
+		EGLint config_count = 0;
+		if (!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || config_count == 0)
+			throw std::runtime_error("Failed to choose an EGL config");
+	}
+
+	EGLint const context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 5,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	m_egl_context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if (m_egl_context == EGL_NO_CONTEXT)
+		throw std::runtime_error("Failed to create the EGL context, error: " + std::to_string(eglGetError()));
+
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_egl_context))
+		throw std::runtime_error("Failed to make the EGL context current, error: " + std::to_string(eglGetError()));
+
+	if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress))
+		throw std::runtime_error("Failed to initialize GLAD");
+
+	printf("[context] EGL %d.%d, OpenGL renderer: %s, version: %s\n", major, minor, glGetString(GL_RENDERER), glGetString(GL_VERSION));
+}
+
+#else
+
+void voxelizer::context::create_egl()
+{
+	throw std::invalid_argument("EGL support wasn't compiled in (VOXELIZER_EGL)");
+}
+
+#endif
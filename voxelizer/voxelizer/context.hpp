@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+namespace voxelizer
+{
+	enum class context_api
+	{
+		GLFW, // Hidden GLFW window, needs a window system (X11, Wayland, Win32...)
+		EGL,  // Surfaceless EGL context, works on display-less machines (e.g. Mesa llvmpipe, NVIDIA headless)
+	};
+
+	/// An OpenGL 4.5 context that isn't meant to be presented. Once created it is current on the calling thread
+	/// and the GL functions are loaded (through glad).
+	class context
+	{
+	private:
+		context_api m_api;
+
+		void* m_window = nullptr; // GLFWwindow*
+
+		void* m_egl_display = nullptr; // EGLDisplay
+		void* m_egl_context = nullptr; // EGLContext
+
+		void create_glfw();
+		void create_egl();
+		void destroy();
+
+	public:
+		explicit context(context_api api = get_default_api());
+		context(context const& other) = delete;
+		~context();
+
+		context_api get_api() const { return m_api; }
+
+		void make_current();
+
+		/// Whether the given API was compiled in.
+		static bool is_supported(context_api api);
+
+		/// EGL if supported, GLFW otherwise.
+		static context_api get_default_api();
+	};
+}
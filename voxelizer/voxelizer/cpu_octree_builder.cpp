@@ -0,0 +1,176 @@
+#include "cpu_octree_builder.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+
+#include "octree.hpp"
+#include "parallel.hpp"
+
+struct sort_key
+{
+	uint64_t m_morton;
+	uint32_t m_voxel_idx; // Breaks the ties, so that the first voxel of a position comes first.
+
+	bool operator<(sort_key const& other) const
+	{
+		return m_morton < other.m_morton || (m_morton == other.m_morton && m_voxel_idx < other.m_voxel_idx);
+	}
+};
+
+// The first level whose prefix (morton >> 3 * (resolution - level)) differs from the previous voxel, resolution + 1 if none.
+static uint32_t get_first_level(std::vector<sort_key> const& keys, size_t i, uint32_t resolution)
+{
+	if (i == 0)
+		return 0;
+
+	uint64_t diff = keys[i].m_morton ^ keys[i - 1].m_morton;
+	if (diff == 0)
+		return resolution + 1;
+
+	uint32_t bit = 63;
+	while ((diff >> bit) == 0)
+		bit--;
+
+	return resolution - bit / 3;
+}
+
+// Same as dedup_merge.comp, the rounded average of the channels.
+static GLuint get_average_color(std::vector<sort_key> const& keys, GLuint const* colors, size_t first)
+{
+	uint32_t sum[4]{};
+	uint32_t count = 0;
+
+	for (size_t i = first; i < keys.size() && keys[i].m_morton == keys[first].m_morton; i++)
+	{
+		GLuint color = colors[keys[i].m_voxel_idx];
+		for (uint32_t channel = 0; channel < 4; channel++)
+			sum[channel] += (color >> (8 * channel)) & 0xff;
+		count++;
+	}
+
+	GLuint result = 0;
+	for (uint32_t channel = 0; channel < 4; channel++)
+		result |= ((sum[channel] + count / 2) / count) << (8 * channel);
+	return result;
+}
+
+// Same as svo_store_leaf.comp, from the RGBA8 value.
+static GLuint pack_leaf(GLuint color)
+{
+	float alpha = (float) (color >> 24) / 255.0f;
+	return (color & 0xffffff) | (((GLuint) (alpha * 127.0f) & 0x7f) << 24);
+}
+
+void voxelizer::cpu_octree_builder::build(
+	voxelizer::host_voxel_list const& voxel_list,
+	uint32_t resolution,
+	std::vector<GLuint>& octree
+)
+{
+	if (voxel_list.m_colors.size() != voxel_list.size())
+		throw std::invalid_argument("The voxel-list must have a color per position");
+
+	build(voxel_list.m_positions.data(), voxel_list.m_colors.data(), voxel_list.size(), resolution, octree);
+}
+
+void voxelizer::cpu_octree_builder::build(
+	glm::uvec3 const* positions,
+	GLuint const* colors,
+	size_t count,
+	uint32_t resolution,
+	std::vector<GLuint>& octree
+)
+{
+	if (resolution == 0 || resolution > voxelizer::k_morton_bits_per_axis)
+		throw std::invalid_argument("Invalid octree resolution, must be between 1 and 21");
+
+	if (count > 0xffffffff)
+		throw std::invalid_argument("Too many voxels, at most 2^32 can be built");
+
+	uint32_t thread_count = voxelizer::get_thread_count(m_thread_count);
+
+	// sort
+	std::vector<sort_key> keys(count);
+	std::atomic<bool> out_of_bounds = false;
+
+	voxelizer::parallel_for(count, thread_count, [&](size_t begin, size_t end, uint32_t)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::uvec3 const& position = positions[i];
+			if ((position.x | position.y | position.z) >> resolution)
+				out_of_bounds = true;
+
+			keys[i] = sort_key{voxelizer::get_morton_code_from_voxel_position(position), (uint32_t) i};
+		}
+	});
+
+	if (out_of_bounds)
+		throw std::invalid_argument("Voxel position out of the octree");
+
+	voxelizer::parallel_sort(keys.begin(), keys.end(), thread_count, std::less<sort_key>());
+
+	// count, the counters are level-major so that the blocks are numbered level after level
+	std::vector<GLuint> counters((size_t) resolution * thread_count, 0);
+
+	voxelizer::parallel_for(count, thread_count, [&](size_t begin, size_t end, uint32_t thread_idx)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			for (uint32_t level = get_first_level(keys, i, resolution); level < resolution; level++)
+				counters[level * thread_count + thread_idx]++;
+		}
+	});
+
+	size_t block_count = 0;
+	for (GLuint& counter : counters)
+	{
+		GLuint value = counter;
+		counter = (GLuint) block_count;
+		block_count += value;
+	}
+
+	block_count = std::max<size_t>(block_count, 1); // The root block, even if the octree is empty.
+
+	if (block_count * 8 > 0x7fffffff)
+		throw std::runtime_error("Octree too large, node addresses exceed 31 bits");
+
+	octree.assign(block_count * 8, 0);
+
+	// write
+	voxelizer::parallel_for(count, thread_count, [&](size_t begin, size_t end, uint32_t thread_idx)
+	{
+		// The block of the current voxel at every level, ranges starting within a block take it from the previous range
+		std::vector<GLuint> blocks(resolution);
+		for (uint32_t level = 0; level < resolution; level++)
+			blocks[level] = counters[level * thread_count + thread_idx] - 1;
+
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t first_level = get_first_level(keys, i, resolution);
+			uint64_t morton = keys[i].m_morton;
+
+			for (uint32_t level = first_level; level < resolution; level++)
+			{
+				blocks[level]++;
+
+				if (level > 0)
+					octree[blocks[level - 1] * 8 + ((morton >> 3 * (resolution - level)) & 7)] = 0x80000000 | (blocks[level] * 8);
+			}
+
+			if (first_level <= resolution)
+			{
+				GLuint color = m_merge_duplicates ? get_average_color(keys, colors, i) : colors[keys[i].m_voxel_idx];
+				octree[blocks[resolution - 1] * 8 + (morton & 7)] = pack_leaf(color);
+			}
+		}
+	});
+
+	printf("[cpu_octree_builder] Octree built - resolution: %d, voxels: %zu, nodes: %zu, threads: %d\n",
+		resolution,
+		count,
+		octree.size(),
+		thread_count
+	);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "voxel_list.hpp"
+
+namespace voxelizer
+{
+	/**
+	 * The CPU counterpart of octree_bottom_up_builder, doesn't need any GL context. The voxels are sorted by Morton code
+	 * (in parallel), then every thread counts the blocks its range of voxels starts at each level. Once the counts are
+	 * summed up every thread owns a contiguous range of blocks per level, where it writes its nodes without any
+	 * synchronization.
+	 *
+	 * The octree has the same encoding of the GPU builders', and its layout is canonical (see octree::canonicalize): it's
+	 * byte-identical to the one of voxel_list_dedup and octree_builder, once canonicalized.
+	 */
+	struct cpu_octree_builder
+	{
+		uint32_t m_thread_count = 0; // 0 means all the hardware threads.
+		bool m_merge_duplicates = true; // Averages the colors of the voxels with the same position (as voxel_list_dedup), otherwise the first one is kept.
+
+		/**
+		 * @param positions  The positions of the voxels, within the octree side (1 << resolution).
+		 * @param colors     The colors of the voxels, RGBA8.
+		 * @param count      The number of voxels.
+		 * @param resolution The resolution of the octree.
+		 * @param octree     The resulting octree, all of its nodes are used.
+		 */
+		void build(
+			glm::uvec3 const* positions,
+			GLuint const* colors,
+			size_t count,
+			uint32_t resolution,
+			std::vector<GLuint>& octree
+		);
+
+		void build(
+			voxelizer::host_voxel_list const& voxel_list,
+			uint32_t resolution,
+			std::vector<GLuint>& octree
+		);
+	};
+}
@@ -0,0 +1,381 @@
+#include "cpu_voxelize.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "parallel.hpp"
+#include "simd.hpp"
+#include "voxelize.hpp"
+
+// ------------------------------------------------------------------------------------------------
+// Triangle/box overlap
+// Reference: Schwarz, Seidel - Fast Parallel Surface and Solid Voxelization on GPUs (2010)
+// ------------------------------------------------------------------------------------------------
+
+struct cpu_voxelize_triangle
+{
+	glm::vec3 m_v[3];     // Vertices in voxel space (a voxel is a unit cube).
+	glm::vec3 m_n;        // Unnormalized normal.
+
+	float m_d1, m_d2;     // Plane overlap: (n * p + d1) * (n * p + d2) <= 0
+
+	glm::vec2 m_n_xy[3];  // Edge functions of the triangle projected on XY, YZ and ZX:
+	glm::vec2 m_n_yz[3];  // n_i * p + d_i >= 0
+	glm::vec2 m_n_zx[3];
+	float m_d_xy[3], m_d_yz[3], m_d_zx[3];
+};
+
+// The overlap test of the voxels of a row (fixed Y and Z) reduced to 8 linear functions of X: a_i * x + b_i.
+// The voxel overlaps if f0 * f1 <= 0 (plane) and f2..f7 >= 0 (XY and ZX projections).
+struct cpu_voxelize_row
+{
+	float m_a[8];
+	float m_b[8];
+};
+
+bool setup_cpu_voxelize_triangle(cpu_voxelize_triangle& tri, glm::vec3 const& v0, glm::vec3 const& v1, glm::vec3 const& v2)
+{
+	tri.m_v[0] = v0;
+	tri.m_v[1] = v1;
+	tri.m_v[2] = v2;
+
+	glm::vec3 e[3] = { v1 - v0, v2 - v1, v0 - v2 };
+
+	tri.m_n = glm::cross(e[0], e[1]);
+	if (tri.m_n == glm::vec3(0)) // Degenerate triangles aren't rasterized by the GPU either
+		return false;
+
+	glm::vec3 const& n = tri.m_n;
+
+	glm::vec3 c(n.x > 0 ? 1.0f : 0.0f, n.y > 0 ? 1.0f : 0.0f, n.z > 0 ? 1.0f : 0.0f); // Critical point
+	tri.m_d1 = glm::dot(n, c - v0);
+	tri.m_d2 = glm::dot(n, (glm::vec3(1.0f) - c) - v0);
+
+	float sign_xy = n.z >= 0 ? 1.0f : -1.0f;
+	float sign_yz = n.x >= 0 ? 1.0f : -1.0f;
+	float sign_zx = n.y >= 0 ? 1.0f : -1.0f;
+
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec3 const& v = tri.m_v[i];
+
+		tri.m_n_xy[i] = glm::vec2(-e[i].y, e[i].x) * sign_xy;
+		tri.m_d_xy[i] = -glm::dot(tri.m_n_xy[i], glm::vec2(v.x, v.y)) + glm::max(0.0f, tri.m_n_xy[i].x) + glm::max(0.0f, tri.m_n_xy[i].y);
+
+		tri.m_n_yz[i] = glm::vec2(-e[i].z, e[i].y) * sign_yz;
+		tri.m_d_yz[i] = -glm::dot(tri.m_n_yz[i], glm::vec2(v.y, v.z)) + glm::max(0.0f, tri.m_n_yz[i].x) + glm::max(0.0f, tri.m_n_yz[i].y);
+
+		tri.m_n_zx[i] = glm::vec2(-e[i].x, e[i].z) * sign_zx;
+		tri.m_d_zx[i] = -glm::dot(tri.m_n_zx[i], glm::vec2(v.z, v.x)) + glm::max(0.0f, tri.m_n_zx[i].x) + glm::max(0.0f, tri.m_n_zx[i].y);
+	}
+
+	return true;
+}
+
+bool setup_cpu_voxelize_row(cpu_voxelize_row& row, cpu_voxelize_triangle const& tri, float y, float z)
+{
+	// The YZ projection doesn't depend on X: the whole row is either in or out
+	for (int i = 0; i < 3; i++)
+	{
+		if (tri.m_n_yz[i].x * y + tri.m_n_yz[i].y * z + tri.m_d_yz[i] < 0)
+			return false;
+	}
+
+	float plane = tri.m_n.y * y + tri.m_n.z * z;
+	row.m_a[0] = tri.m_n.x; row.m_b[0] = plane + tri.m_d1;
+	row.m_a[1] = tri.m_n.x; row.m_b[1] = plane + tri.m_d2;
+
+	for (int i = 0; i < 3; i++)
+	{
+		row.m_a[2 + i] = tri.m_n_xy[i].x;
+		row.m_b[2 + i] = tri.m_n_xy[i].y * y + tri.m_d_xy[i];
+
+		row.m_a[5 + i] = tri.m_n_zx[i].y;
+		row.m_b[5 + i] = tri.m_n_zx[i].x * z + tri.m_d_zx[i];
+	}
+
+	return true;
+}
+
+void find_row_voxels_scalar(cpu_voxelize_row const& row, uint32_t x_begin, uint32_t x_end, std::vector<uint32_t>& result)
+{
+	for (uint32_t x = x_begin; x < x_end; x++)
+	{
+		float f[8];
+		for (int i = 0; i < 8; i++)
+			f[i] = row.m_a[i] * float(x) + row.m_b[i];
+
+		if (f[0] * f[1] <= 0 && f[2] >= 0 && f[3] >= 0 && f[4] >= 0 && f[5] >= 0 && f[6] >= 0 && f[7] >= 0)
+			result.push_back(x);
+	}
+}
+
+#if defined(VOXELIZER_X86)
+
+void find_row_voxels_sse(cpu_voxelize_row const& row, uint32_t x_begin, uint32_t x_end, std::vector<uint32_t>& result)
+{
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const lane = _mm_setr_ps(0, 1, 2, 3);
+
+	for (uint32_t x = x_begin; x < x_end; x += 4)
+	{
+		__m128 xs = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+
+		__m128 f0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row.m_a[0]), xs), _mm_set1_ps(row.m_b[0]));
+		__m128 f1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row.m_a[1]), xs), _mm_set1_ps(row.m_b[1]));
+		__m128 mask = _mm_cmple_ps(_mm_mul_ps(f0, f1), zero);
+
+		for (int i = 2; i < 8; i++)
+		{
+			__m128 f = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row.m_a[i]), xs), _mm_set1_ps(row.m_b[i]));
+			mask = _mm_and_ps(mask, _mm_cmpge_ps(f, zero));
+		}
+
+		uint32_t bits = (uint32_t) _mm_movemask_ps(mask);
+		bits &= (1u << std::min<uint32_t>(x_end - x, 4)) - 1;
+
+		for (; bits != 0; bits &= bits - 1)
+			result.push_back(x + voxelizer::simd::count_trailing_zeros(bits));
+	}
+}
+
+VOXELIZER_TARGET_AVX2
+void find_row_voxels_avx2(cpu_voxelize_row const& row, uint32_t x_begin, uint32_t x_end, std::vector<uint32_t>& result)
+{
+	__m256 const zero = _mm256_setzero_ps();
+	__m256 const lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (uint32_t x = x_begin; x < x_end; x += 8)
+	{
+		__m256 xs = _mm256_add_ps(_mm256_set1_ps(float(x)), lane);
+
+		__m256 f0 = _mm256_fmadd_ps(_mm256_set1_ps(row.m_a[0]), xs, _mm256_set1_ps(row.m_b[0]));
+		__m256 f1 = _mm256_fmadd_ps(_mm256_set1_ps(row.m_a[1]), xs, _mm256_set1_ps(row.m_b[1]));
+		__m256 mask = _mm256_cmp_ps(_mm256_mul_ps(f0, f1), zero, _CMP_LE_OQ);
+
+		for (int i = 2; i < 8; i++)
+		{
+			__m256 f = _mm256_fmadd_ps(_mm256_set1_ps(row.m_a[i]), xs, _mm256_set1_ps(row.m_b[i]));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(f, zero, _CMP_GE_OQ));
+		}
+
+		uint32_t bits = (uint32_t) _mm256_movemask_ps(mask);
+		bits &= (1u << std::min<uint32_t>(x_end - x, 8)) - 1;
+
+		for (; bits != 0; bits &= bits - 1)
+			result.push_back(x + voxelizer::simd::count_trailing_zeros(bits));
+	}
+}
+
+#endif
+
+using find_row_voxels_t = void (*)(cpu_voxelize_row const&, uint32_t, uint32_t, std::vector<uint32_t>&);
+
+find_row_voxels_t select_find_row_voxels()
+{
+#if defined(VOXELIZER_X86)
+	return voxelizer::simd::has_avx2() ? find_row_voxels_avx2 : find_row_voxels_sse;
+#else
+	return find_row_voxels_scalar;
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+// Shading
+// ------------------------------------------------------------------------------------------------
+
+glm::vec4 sample_image(voxelizer::material::image const& image, glm::vec2 uv)
+{
+	if (image.m_data.empty())
+		return glm::vec4(1);
+
+	// Bilinear filtering, clamped to the edge (as the GPU samples it)
+	glm::vec2 texel = uv * glm::vec2(image.m_width, image.m_height) - 0.5f;
+	glm::vec2 base = glm::floor(texel);
+	glm::vec2 f = texel - base;
+
+	auto fetch = [&](int x, int y)
+	{
+		x = glm::clamp(x, 0, image.m_width - 1);
+		y = glm::clamp(y, 0, image.m_height - 1);
+
+		uint8_t const* pixel = image.m_data.data() + (size_t(y) * image.m_width + x) * 4;
+		return glm::vec4(pixel[0], pixel[1], pixel[2], pixel[3]) / 255.0f;
+	};
+
+	int x = (int) base.x, y = (int) base.y;
+	glm::vec4 bottom = glm::mix(fetch(x, y), fetch(x + 1, y), f.x);
+	glm::vec4 top = glm::mix(fetch(x, y + 1), fetch(x + 1, y + 1), f.x);
+	return glm::mix(bottom, top, f.y);
+}
+
+GLuint pack_rgba8(glm::vec4 color)
+{
+	color = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+	return GLuint(color.r) | (GLuint(color.g) << 8) | (GLuint(color.b) << 16) | (GLuint(color.a) << 24);
+}
+
+// ------------------------------------------------------------------------------------------------
+// cpu_voxelize
+// ------------------------------------------------------------------------------------------------
+
+void voxelizer::cpu_voxelize::operator()(
+	voxelizer::host_voxel_list& voxel_list,
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size
+)
+{
+	glm::mat4 scene_norm_mtx = voxelizer::voxelize::create_scene_normalization_matrix(area_position, area_size);
+
+	glm::uvec3 grid = voxelizer::voxelize::calc_proportional_grid(area_size, voxels_on_y);
+	uint32_t max_side = glm::max(grid.x, glm::max(grid.y, grid.z)); // Same as the viewport used by the GPU.
+
+	uint32_t thread_count = voxelizer::get_thread_count(m_thread_count);
+
+	printf("[cpu_voxelize] Grid of size (%d, %d, %d), threads: %d, AVX2: %s\n",
+		grid.x, grid.y, grid.z,
+		thread_count,
+		voxelizer::simd::has_avx2() ? "yes" : "no"
+	);
+
+	for (voxelizer::mesh const& mesh : scene.m_meshes)
+	{
+		if (mesh.m_positions.empty() && mesh.m_triangle_count > 0)
+		{
+			throw std::invalid_argument("Mesh without host data, the scene must be loaded keeping it");
+		}
+	}
+
+	// Transforms the vertices of every mesh to the voxel space
+	std::vector<std::vector<glm::vec3>> vertices(scene.m_meshes.size());
+
+	voxelizer::parallel_for(scene.m_meshes.size(), thread_count, [&](size_t begin, size_t end, uint32_t)
+	{
+		for (size_t mesh_idx = begin; mesh_idx < end; mesh_idx++)
+		{
+			voxelizer::mesh const& mesh = scene.m_meshes[mesh_idx];
+			glm::mat4 transform = scene_norm_mtx * mesh.m_transform;
+
+			vertices[mesh_idx].resize(mesh.m_positions.size());
+			for (size_t i = 0; i < mesh.m_positions.size(); i++)
+			{
+				vertices[mesh_idx][i] = glm::vec3(transform * glm::vec4(mesh.m_positions[i], 1.0f)) * float(max_side);
+			}
+		}
+	});
+
+	// Triangles of all the meshes are split evenly among the threads
+	std::vector<size_t> first_triangle(scene.m_meshes.size() + 1, 0);
+	for (size_t mesh_idx = 0; mesh_idx < scene.m_meshes.size(); mesh_idx++)
+	{
+		first_triangle[mesh_idx + 1] = first_triangle[mesh_idx] + scene.m_meshes[mesh_idx].m_indices.size() / 3;
+	}
+
+	find_row_voxels_t find_row_voxels = select_find_row_voxels();
+
+	std::vector<voxelizer::host_voxel_list> thread_voxel_lists(thread_count);
+
+	voxelizer::parallel_for(first_triangle.back(), thread_count, [&](size_t begin, size_t end, uint32_t thread_idx)
+	{
+		voxelizer::host_voxel_list& result = thread_voxel_lists[thread_idx];
+		std::vector<uint32_t> row_voxels;
+
+		size_t mesh_idx = std::upper_bound(first_triangle.begin(), first_triangle.end(), begin) - first_triangle.begin() - 1;
+
+		for (size_t triangle_idx = begin; triangle_idx < end; triangle_idx++)
+		{
+			while (triangle_idx >= first_triangle[mesh_idx + 1])
+				mesh_idx++;
+
+			voxelizer::mesh const& mesh = scene.m_meshes[mesh_idx];
+			std::vector<glm::vec3> const& mesh_vertices = vertices[mesh_idx];
+
+			GLuint const* indices = &mesh.m_indices[(triangle_idx - first_triangle[mesh_idx]) * 3];
+
+			cpu_voxelize_triangle tri{};
+			if (!setup_cpu_voxelize_triangle(tri, mesh_vertices[indices[0]], mesh_vertices[indices[1]], mesh_vertices[indices[2]]))
+				continue;
+
+			glm::vec3 tri_min = glm::min(glm::min(tri.m_v[0], tri.m_v[1]), tri.m_v[2]);
+			glm::vec3 tri_max = glm::max(glm::max(tri.m_v[0], tri.m_v[1]), tri.m_v[2]);
+
+			if (tri_max.x < 0 || tri_max.y < 0 || tri_max.z < 0 || tri_min.x > grid.x || tri_min.y > grid.y || tri_min.z > grid.z)
+				continue;
+
+			// Voxels merely touching the triangle overlap as well
+			glm::uvec3 from = glm::uvec3(glm::max(glm::ceil(tri_min) - 1.0f, glm::vec3(0)));
+			glm::uvec3 to = glm::min(glm::uvec3(glm::floor(tri_max)) + 1u, grid); // Exclusive
+
+			glm::vec4 material_color = mesh.m_material->get_color(material::type::DIFFUSE);
+			voxelizer::material::image const& image = mesh.m_material->get_image(material::type::DIFFUSE);
+
+			float n_length2 = glm::dot(tri.m_n, tri.m_n);
+
+			for (uint32_t z = from.z; z < to.z; z++)
+			{
+				for (uint32_t y = from.y; y < to.y; y++)
+				{
+					cpu_voxelize_row row{};
+					if (!setup_cpu_voxelize_row(row, tri, float(y), float(z)))
+						continue;
+
+					row_voxels.clear();
+					find_row_voxels(row, from.x, to.x, row_voxels);
+
+					for (uint32_t x : row_voxels)
+					{
+						// Barycentric coordinates of the voxel center projected on the triangle, clamped to its area
+						glm::vec3 p = glm::vec3(x, y, z) + 0.5f;
+
+						glm::vec3 b;
+						b.x = glm::dot(tri.m_n, glm::cross(tri.m_v[2] - tri.m_v[1], p - tri.m_v[1])) / n_length2;
+						b.y = glm::dot(tri.m_n, glm::cross(tri.m_v[0] - tri.m_v[2], p - tri.m_v[2])) / n_length2;
+						b.z = 1.0f - b.x - b.y;
+						b = glm::max(b, glm::vec3(0));
+						b /= b.x + b.y + b.z;
+
+						glm::vec4 color = material_color;
+
+						if (!mesh.m_colors.empty())
+						{
+							color *= mesh.m_colors[indices[0]] * b.x + mesh.m_colors[indices[1]] * b.y + mesh.m_colors[indices[2]] * b.z;
+						}
+
+						glm::vec2 uv(0);
+						if (!mesh.m_uvs.empty())
+						{
+							uv = mesh.m_uvs[indices[0]] * b.x + mesh.m_uvs[indices[1]] * b.y + mesh.m_uvs[indices[2]] * b.z;
+						}
+
+						color *= sample_image(image, glm::vec2(uv.x, 1 - uv.y)); // Same UV flip as voxelize.frag
+						color.a = 1.0f;
+
+						result.m_positions.emplace_back(x, y, z);
+						result.m_colors.push_back(pack_rgba8(color));
+					}
+				}
+			}
+		}
+	});
+
+	// Gathers the per-thread results, ordered as the triangles of the scene
+	size_t voxel_count = 0;
+	for (voxelizer::host_voxel_list const& thread_voxel_list : thread_voxel_lists)
+		voxel_count += thread_voxel_list.size();
+
+	voxel_list.m_positions.clear();
+	voxel_list.m_colors.clear();
+	voxel_list.m_positions.reserve(voxel_count);
+	voxel_list.m_colors.reserve(voxel_count);
+
+	for (voxelizer::host_voxel_list const& thread_voxel_list : thread_voxel_lists)
+	{
+		voxel_list.m_positions.insert(voxel_list.m_positions.end(), thread_voxel_list.m_positions.begin(), thread_voxel_list.m_positions.end());
+		voxel_list.m_colors.insert(voxel_list.m_colors.end(), thread_voxel_list.m_colors.begin(), thread_voxel_list.m_colors.end());
+	}
+
+	printf("[cpu_voxelize] Voxel-list of %zu elements generated\n", voxel_list.size());
+}
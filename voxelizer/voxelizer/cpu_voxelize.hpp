@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "scene.hpp"
+#include "voxel_list.hpp"
+
+namespace voxelizer
+{
+	/**
+	 * The CPU counterpart of voxelize, doesn't need any GL context. The scene must be loaded with its host data
+	 * (e.g. assimp_scene_loader::m_keep_host_data).
+	 *
+	 * Voxels are found with a conservative (26-separating) triangle/box overlap test, vectorized along the X axis with
+	 * AVX2 when the CPU supports it, SSE otherwise. Triangles are split among all the threads.
+	 */
+	struct cpu_voxelize
+	{
+		uint32_t m_thread_count = 0; // 0 means all the hardware threads.
+
+		/**
+		 * @param voxel_list  The resulting list of voxels generated.
+		 * @param scene       The scene to voxelize.
+		 * @param voxels_on_y Number of voxels along the Y axis.
+		 * @param offset      Where to start taking the voxelization area.
+		 * @param size        The size of the voxelization area.
+		 */
+		void operator()(
+			voxelizer::host_voxel_list& voxel_list,
+			voxelizer::scene const& scene,
+			uint32_t voxels_on_y,
+			glm::vec3 area_position,
+			glm::vec3 area_size
+		);
+	};
+}
@@ -79,7 +79,8 @@ voxelizer::program::program() :
 }
 
 voxelizer::program::program(voxelizer::program&& other) :
-	m_name(other.m_name)
+	m_name(other.m_name),
+	m_uniform_locations(std::move(other.m_uniform_locations))
 {
 	other.m_name = NULL;
 }
@@ -112,6 +113,34 @@ void voxelizer::program::link()
 		std::cerr << get_log() << std::endl;
 		throw std::runtime_error("Program compilation failed");
 	}
+
+	// Uniform locations are resolved once, so that setting a uniform doesn't look its name up in the driver
+	m_uniform_locations.clear();
+
+	GLint uniform_count{}, max_name_length{};
+	glGetProgramiv(m_name, GL_ACTIVE_UNIFORMS, &uniform_count);
+	glGetProgramiv(m_name, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
+
+	std::vector<GLchar> name(glm::max(max_name_length, 1));
+
+	for (GLint i = 0; i < uniform_count; i++)
+	{
+		GLsizei name_length{};
+		GLint size{};
+		GLenum type{};
+		glGetActiveUniform(m_name, (GLuint) i, (GLsizei) name.size(), &name_length, &size, &type, name.data());
+
+		GLint location = glGetUniformLocation(m_name, name.data());
+		if (location < 0)
+			continue; // Members of uniform blocks
+
+		std::string uniform_name(name.data(), name_length);
+		m_uniform_locations[uniform_name] = location;
+
+		// Arrays are listed by their first element, they can be referred by their name too
+		if (uniform_name.size() > 3 && uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0)
+			m_uniform_locations[uniform_name.substr(0, uniform_name.size() - 3)] = location;
+	}
 }
 
 void voxelizer::program::use()
@@ -147,12 +176,12 @@ GLint voxelizer::program::get_attrib_location(GLchar const* attrib_name) const
 
 GLint voxelizer::program::get_uniform_location(GLchar const* uniform_name) const
 {
-	GLint location = glGetUniformLocation(m_name, uniform_name);
-	if (location < 0)
+	auto found = m_uniform_locations.find(uniform_name);
+	if (found == m_uniform_locations.end())
 	{
 		throw std::invalid_argument("Invalid uniform name");
 	}
-	return location;
+	return found->second;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -182,7 +211,7 @@ voxelizer::texture_buffer::~texture_buffer()
 		glDeleteTextures(1, &m_texture_name);
 }
 
-void voxelizer::texture_buffer::load_data(GLsizei size, const void* data, GLenum usage)
+void voxelizer::texture_buffer::load_data(GLsizeiptr size, const void* data, GLenum usage)
 {
 	glBindBuffer(GL_TEXTURE_BUFFER, m_buffer_name);
 
@@ -254,6 +283,89 @@ void voxelizer::atomic_counter::bind(GLuint binding)
 	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, binding, m_name);
 }
 
+// ------------------------------------------------------------------------------------------------
+// staging_ring
+// ------------------------------------------------------------------------------------------------
+
+voxelizer::staging_ring::staging_ring(size_t slot_size, uint32_t slot_count, GLbitfield access) :
+	m_slot_size(slot_size),
+	m_fences(slot_count, NULL)
+{
+	GLbitfield flags = access | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	// Reading from the mapping is only fast if it's cached host memory
+	GLbitfield storage_flags = (access & GL_MAP_READ_BIT) ? flags | GL_CLIENT_STORAGE_BIT : flags;
+
+	glGenBuffers(1, &m_name);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_name);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr) (slot_size * slot_count), nullptr, storage_flags);
+
+	m_mapped = (uint8_t*) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr) (slot_size * slot_count), flags);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (m_mapped == nullptr)
+		throw std::runtime_error("Failed to map the staging buffer");
+}
+
+voxelizer::staging_ring::~staging_ring()
+{
+	for (GLsync fence : m_fences)
+	{
+		if (fence != NULL)
+			glDeleteSync(fence);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_name);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glDeleteBuffers(1, &m_name);
+}
+
+size_t voxelizer::staging_ring::acquire()
+{
+	GLsync& fence = m_fences[m_next_slot];
+
+	if (fence != NULL)
+	{
+		// The first wait flushes, so that the fence is guaranteed to signal
+		GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		while (glClientWaitSync(fence, flags, 1000000000) == GL_TIMEOUT_EXPIRED)
+			flags = 0;
+
+		glDeleteSync(fence);
+		fence = NULL;
+	}
+
+	return m_next_slot * m_slot_size;
+}
+
+void voxelizer::staging_ring::release()
+{
+	m_fences[m_next_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_next_slot = (m_next_slot + 1) % m_fences.size();
+}
+
+// ------------------------------------------------------------------------------------------------
+// dispatch
+// ------------------------------------------------------------------------------------------------
+
+void voxelizer::dispatch_compute_1d(size_t count, GLuint local_size)
+{
+	size_t workgroup_count = (count + local_size - 1) / local_size;
+	if (workgroup_count == 0)
+		return;
+
+	GLint max_workgroup_count_x{};
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_workgroup_count_x);
+
+	size_t x = glm::min(workgroup_count, (size_t) max_workgroup_count_x);
+	size_t y = (workgroup_count + x - 1) / x;
+
+	glDispatchCompute((GLuint) x, (GLuint) y, 1);
+}
+
 // ------------------------------------------------------------------------------------------------
 // debug_renderer
 // ------------------------------------------------------------------------------------------------
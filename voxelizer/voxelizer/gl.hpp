@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <functional>
+#include <unordered_map>
+#include <vector>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -36,6 +39,7 @@ namespace voxelizer
 	struct program
 	{
 		GLuint m_name;
+		std::unordered_map<std::string, GLint> m_uniform_locations; // All the active uniforms, resolved once linked.
 
 		program();
 		program(program const&) = delete;
@@ -54,7 +58,45 @@ namespace voxelizer
 		std::string get_log();
 
 		GLint get_attrib_location(const GLchar* name) const;
-		GLint get_uniform_location(const GLchar* name) const;
+		GLint get_uniform_location(const GLchar* name) const; // Doesn't query the driver, hot loops should still resolve it once.
+	};
+
+	// ------------------------------------------------------------------------------------------------
+	// uniform_buffer
+	// ------------------------------------------------------------------------------------------------
+
+	/// A uniform buffer holding a single _data, whose layout must match the std140 block of the shaders.
+	template<typename _data>
+	struct uniform_buffer
+	{
+		GLuint m_name;
+
+		uniform_buffer()
+		{
+			glGenBuffers(1, &m_name);
+			glBindBuffer(GL_UNIFORM_BUFFER, m_name);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(_data), nullptr, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+
+		uniform_buffer(uniform_buffer const&) = delete;
+
+		~uniform_buffer()
+		{
+			glDeleteBuffers(1, &m_name);
+		}
+
+		void update(_data const& data)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, m_name);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(_data), &data);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+
+		void bind(GLuint binding) const
+		{
+			glBindBufferBase(GL_UNIFORM_BUFFER, binding, m_name);
+		}
 	};
 
 	// ------------------------------------------------------------------------------------------------
@@ -72,7 +114,7 @@ namespace voxelizer
 
 		~texture_buffer();
 
-		void load_data(GLsizei size, const void* data, GLenum usage);
+		void load_data(GLsizeiptr size, const void* data, GLenum usage);
 		void set_format(GLenum format);
 
 		void bind(GLuint binding, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format) const;
@@ -98,6 +140,42 @@ namespace voxelizer
 		void bind(GLuint binding);
 	};
 
+	// ------------------------------------------------------------------------------------------------
+	// staging_ring
+	// ------------------------------------------------------------------------------------------------
+
+	/// A persistent-mapped buffer split in slots, to stream data to the GPU (e.g. as a GL_PIXEL_UNPACK_BUFFER) or back from
+	/// it while the previous copies are still in flight. A slot is acquired again only once the commands using it have
+	/// completed, so for read rings `acquire` is also what waits for the data copied in the slot.
+	struct staging_ring
+	{
+		GLuint m_name;
+		uint8_t* m_mapped;
+		size_t m_slot_size;
+		std::vector<GLsync> m_fences; // One per slot, NULL if the slot is free.
+		uint32_t m_next_slot = 0;
+
+		/// @param access GL_MAP_WRITE_BIT to upload, GL_MAP_READ_BIT to read back (the buffer is then in host memory).
+		staging_ring(size_t slot_size, uint32_t slot_count, GLbitfield access = GL_MAP_WRITE_BIT);
+		staging_ring(staging_ring const&) = delete;
+
+		~staging_ring();
+
+		/// Waits for the next slot to be free and returns its offset within the buffer (the data goes to m_mapped + offset).
+		size_t acquire();
+
+		/// Fences the slot last acquired, to be called after the commands using it have been issued.
+		void release();
+	};
+
+	// ------------------------------------------------------------------------------------------------
+	// dispatch
+	// ------------------------------------------------------------------------------------------------
+
+	/// Dispatches the workgroups needed to cover `count` invocations. Workgroups exceeding the X limit are laid out on Y,
+	/// so the shader has to compute its index as `gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x`.
+	void dispatch_compute_1d(size_t count, GLuint local_size);
+
 	// ------------------------------------------------------------------------------------------------
 	// debug_renderer
 	// ------------------------------------------------------------------------------------------------
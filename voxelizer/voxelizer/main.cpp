@@ -1,17 +1,29 @@
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
-#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <glad/glad.h>
-#include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/integer.hpp>
 
+#include "context.hpp"
+#include "cpu_octree_builder.hpp"
 #include "octree.hpp"
-#include "octree_builder.hpp"
+#include "octree_io.hpp"
+#include "octree_query.hpp"
 #include "ai_scene_loader.hpp"
 #include "scene.hpp"
+#include "scene_batch.hpp"
 #include "voxelize.hpp"
+#include "cpu_voxelize.hpp"
+#include "tiled_voxelize.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
 
 void GLAPIENTRY message_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, GLchar const* message, void const* userParam)
 {
@@ -22,37 +34,30 @@ void GLAPIENTRY message_callback(GLenum source, GLenum type, GLuint id, GLenum s
 	}
 }
 
-bool is_little_endian()
-{
-	uint16_t test = 0x0001;
-	char* test_ptr = (char*)&test;
-	return test_ptr[0];
-}
-
-uint32_t swap_binary(uint32_t value)
-{
-	std::uint32_t tmp = ((value << 8) & 0xFF00FF00) | ((value >> 8) & 0xFF00FF);
-	return (tmp << 16) | (tmp >> 16);
-}
-
 void run_voxelizer(
 	std::filesystem::path const& input_file_path,
 	uint32_t volume_height,
-	std::filesystem::path const& output_file_path
+	std::filesystem::path const& output_file_path,
+	bool use_cpu,
+	size_t max_tile_voxels,
+	std::filesystem::path const& scene_cache_folder,
+	bool build_dag,
+	uint32_t file_version
 )
 {
 	voxelizer::assimp_scene_loader scene_loader{};
 	voxelizer::scene scene{};
 
+	scene_loader.m_upload_to_gpu = !use_cpu;
+	scene_loader.m_keep_host_data = use_cpu;
+	scene_loader.m_cache_folder = scene_cache_folder;
+
 	printf("Loading scene \"%s\"\n", input_file_path.u8string().c_str());
 
 	scene_loader.load(scene, input_file_path);
 
 	printf("Scene loaded\n");
 
-	voxelizer::voxelize voxelize{};
-	voxelizer::voxel_list voxel_list{};
-
 	glm::vec3 area_size = scene.get_transformed_size();
 	glm::uvec3 volume_size = voxelizer::voxelize::calc_proportional_grid(area_size, volume_height);
 	uint32_t max_volume_side = glm::max(glm::max(volume_size.x, volume_size.y), volume_size.z);
@@ -67,52 +72,178 @@ void run_voxelizer(
 		max_volume_side
 	);
 
-	voxelize(voxel_list, scene, volume_height, scene.m_transformed_min, scene.get_transformed_size());
-
-	printf("Generated a voxel list of %zu elements\n", voxel_list.m_size);
+	if (max_volume_side > voxelizer::k_voxel_list_max_side)
+		throw std::invalid_argument("Volume too large, the max side can be at most " + std::to_string(voxelizer::k_voxel_list_max_side));
 
-	voxelizer::octree_builder octree_builder{};
-	GLuint octree_buffer{};
 	uint32_t octree_resolution = (uint32_t) glm::ceil(glm::log2((float) max_volume_side));
-	size_t octree_bytesize = voxelizer::octree::get_octree_bytesize(octree_resolution);
+	std::vector<GLuint> octree_data;
 
-	printf("Allocating an octree of resolution %d (%zu bytes ~ %.1f MB)\n", octree_resolution, octree_bytesize, ((float) octree_bytesize / (1024 * 1024)));
+	if (use_cpu)
+	{
+		// Everything runs on the host, no GL context is needed
+		voxelizer::cpu_voxelize cpu_voxelize{};
+		voxelizer::host_voxel_list host_voxel_list{};
+
+		cpu_voxelize(host_voxel_list, scene, volume_height, scene.m_transformed_min, scene.get_transformed_size());
+
+		printf("Generated a voxel list of %zu elements\n", host_voxel_list.size());
+		printf("Building the octree, resolution: %d\n", octree_resolution);
+
+		// One voxel per position, with the average color
+		voxelizer::cpu_octree_builder cpu_octree_builder{};
+		cpu_octree_builder.build(host_voxel_list, octree_resolution, octree_data);
+	}
+	else
+	{
+		// The meshes are merged so that every voxelization pass is a few multi-draws, instead of a draw per mesh
+		scene.m_batch = std::make_shared<voxelizer::scene_batch>(scene);
 
-	glGenBuffers(1, &octree_buffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree_buffer);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, octree_bytesize, nullptr, NULL);
+		// Voxelizes and builds the octree one tile at a time, within the voxel budget
+		voxelizer::tiled_voxelize tiled_voxelize{};
+		tiled_voxelize.m_max_tile_voxels = max_tile_voxels;
 
-	printf("Building the octree\n");
+		octree_resolution = tiled_voxelize(octree_data, scene, volume_height, scene.m_transformed_min, scene.get_transformed_size());
+	}
 
-	// Build the octree
-	voxelizer::octree octree{};
-	octree_builder.build(voxel_list, octree_resolution, octree_buffer, 0, octree);
+	printf("Octree built, used %zu nodes (%zu bytes ~ %.1f MB)\n",
+		octree_data.size(),
+		octree_data.size() * sizeof(GLuint),
+		((float) (octree_data.size() * sizeof(GLuint)) / (1024 * 1024))
+	);
 
-	// Download octree from GPU
-	std::vector<GLuint> octree_buffer_data(octree_bytesize / sizeof(GLuint));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree_buffer);
-	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, octree_bytesize, octree_buffer_data.data());
+	if (build_dag)
+	{
+		size_t merged_blocks = voxelizer::octree::deduplicate(octree_data);
+
+		printf("Octree deduplicated into a DAG, merged %zu blocks: %zu nodes (%zu bytes ~ %.1f MB)\n",
+			merged_blocks,
+			octree_data.size(),
+			octree_data.size() * sizeof(GLuint),
+			((float) (octree_data.size() * sizeof(GLuint)) / (1024 * 1024))
+		);
+	}
 
 	// Write on file
 	printf("Writing to the output file \"%s\"\n", output_file_path.u8string().c_str());
 
-	std::ofstream output_file_stream(output_file_path, std::ios::binary);
+	voxelizer::write_octree_file(output_file_path, volume_size, octree_resolution, octree_data, file_version);
+}
+
+double get_elapsed_seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Times the CPU queries on the octree file written (see octree_query) and checks that the batched queries, traced in
+/// SIMD packets, give the same results of the scalar ones. Returns false if they don't.
+bool run_query_bench(std::filesystem::path const& octree_file_path)
+{
+	constexpr size_t k_ray_count = 1 << 20;
+	constexpr size_t k_lookup_count = 1 << 22;
+
+	voxelizer::octree_file_header header{};
+	std::vector<GLuint> octree_data = voxelizer::read_octree_file(octree_file_path, header);
+
+	voxelizer::octree_query query(octree_data.data(), header.m_resolution);
+
+	float side = (float) (1u << header.m_resolution);
+
+	// Rays from a sphere around the octree to points within it, so that most of them traverse some nodes
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+
+	std::vector<voxelizer::octree_ray> rays(k_ray_count);
+	for (voxelizer::octree_ray& ray : rays)
+	{
+		glm::vec3 direction(normal(random), normal(random), normal(random));
+		glm::vec3 target = glm::vec3(uniform(random), uniform(random), uniform(random)) * side;
+
+		ray.m_origin = glm::vec3(side * 0.5f) + glm::normalize(direction) * side;
+		ray.m_direction = target - ray.m_origin;
+	}
+
+	std::vector<glm::uvec3> positions(k_lookup_count);
+	for (glm::uvec3& position : positions)
+		position = glm::uvec3(glm::vec3(uniform(random), uniform(random), uniform(random)) * side) & ((1u << header.m_resolution) - 1);
 
-	auto writeU32 = [](std::ofstream& output, uint32_t value)
+	printf("[bench] Octree resolution: %d, nodes: %zu, threads: %d\n", header.m_resolution, octree_data.size(), voxelizer::get_thread_count(query.m_thread_count));
+
+	// The scalar queries, on a single thread, are the reference of the batched ones
+	std::vector<voxelizer::octree_ray_hit> scalar_hits(k_ray_count);
+	std::vector<GLuint> scalar_values(k_lookup_count);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rays.size(); i++)
+		query.raycast(rays[i], scalar_hits[i]);
+	double seconds = get_elapsed_seconds(start);
+
+	size_t hit_count = 0;
+	for (voxelizer::octree_ray_hit const& hit : scalar_hits)
+		hit_count += hit.m_value != 0;
+
+	printf("[bench] Scalar raycast - rays: %zu, hits: %zu, %.2f Mrays/s\n", rays.size(), hit_count, rays.size() / seconds * 1e-6);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < positions.size(); i++)
+		scalar_values[i] = query.lookup(positions[i]);
+	seconds = get_elapsed_seconds(start);
+
+	printf("[bench] Scalar lookup - positions: %zu, %.2f Mlookups/s\n", positions.size(), positions.size() / seconds * 1e-6);
+
+	// Every batched path the CPU supports
+	std::vector<bool> use_avx2_modes{false};
+#if defined(VOXELIZER_X86)
+	if (voxelizer::simd::has_avx2())
+		use_avx2_modes.push_back(true);
+#endif
+
+	std::vector<voxelizer::octree_ray_hit> hits(k_ray_count);
+	std::vector<GLuint> values(k_lookup_count);
+
+	bool is_valid = true;
+
+	for (bool use_avx2 : use_avx2_modes)
 	{
-		value = is_little_endian() ? value : swap_binary(value);
-		output.write((char*) &value, sizeof(GLuint));
-	};
-
-	writeU32(output_file_stream, 0x01); // Version (?)
-	writeU32(output_file_stream, volume_size.x);
-	writeU32(output_file_stream, volume_size.y);
-	writeU32(output_file_stream, volume_size.z);
-	writeU32(output_file_stream, octree_resolution);
-	writeU32(output_file_stream, octree_bytesize);
-
-	for (int i = 0; i < octree_buffer_data.size(); i++)
-		writeU32(output_file_stream, octree_buffer_data[i]);
+		query.m_use_avx2 = use_avx2;
+
+		// Without AVX2 the rays are traced in SSE packets, the points looked up one at a time (on all the threads)
+#if defined(VOXELIZER_X86)
+		char const* ray_path = use_avx2 ? "AVX2" : "SSE";
+#else
+		char const* ray_path = "Batched";
+#endif
+		char const* lookup_path = use_avx2 ? "AVX2" : "Batched";
+
+		start = std::chrono::steady_clock::now();
+		query.raycast(rays.data(), rays.size(), hits.data());
+		seconds = get_elapsed_seconds(start);
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < rays.size(); i++)
+		{
+			if (hits[i].m_value != scalar_hits[i].m_value || (hits[i].m_value != 0 && hits[i].m_t != scalar_hits[i].m_t))
+				mismatches++;
+		}
+
+		printf("[bench] %s raycast - %.2f Mrays/s, mismatches: %zu\n", ray_path, rays.size() / seconds * 1e-6, mismatches);
+
+		is_valid &= mismatches == 0;
+
+		start = std::chrono::steady_clock::now();
+		query.lookup(positions.data(), positions.size(), values.data());
+		seconds = get_elapsed_seconds(start);
+
+		mismatches = 0;
+		for (size_t i = 0; i < positions.size(); i++)
+			mismatches += values[i] != scalar_values[i];
+
+		printf("[bench] %s lookup - %.2f Mlookups/s, mismatches: %zu\n", lookup_path, positions.size() / seconds * 1e-6, mismatches);
+
+		is_valid &= mismatches == 0;
+	}
+
+	return is_valid;
 }
 
 int main(int argc, char* argv[])
@@ -122,7 +253,7 @@ int main(int argc, char* argv[])
 
 	if (argc < 3)
 	{
-		printf("Invalid command syntax: ./voxelizer <input-file> <volume-height> <output-file>\n");
+		printf("Invalid command syntax: ./voxelizer <input-file> <volume-height> <output-file> [--cpu] [--context <egl|glfw>] [--max-tile-voxels <count>] [--scene-cache <folder>] [--dag] [--uncompressed] [--bench]\n");
 		return 1;
 	}
 
@@ -136,46 +267,129 @@ int main(int argc, char* argv[])
 
 	// Volume height
 	int32_t volume_height = std::stoi(argv[1]);
-	if (volume_height <= 0 || volume_height > 256)
+	if (volume_height <= 0 || (uint32_t) volume_height > voxelizer::k_voxel_list_max_side)
 	{
-		printf("Volume height out of bounds: [1, 256]\n");
+		printf("Volume height out of bounds: [1, %d]\n", voxelizer::k_voxel_list_max_side);
 		return 3;
 	}
 
 	// Output file
 	std::filesystem::path output_file_path = argv[2];
 
-	printf("Initializing OpenGL context\n");
+	// Options
+	bool use_cpu = false; // Voxelizes and builds the octree on the CPU, without any GL context
+	voxelizer::context_api context_api = voxelizer::context::get_default_api();
+	size_t max_tile_voxels = voxelizer::tiled_voxelize::k_default_max_tile_voxels; // Bounds the GPU memory used by the GPU voxelizer
+	std::filesystem::path scene_cache_folder; // Where the imported scenes are cached, not cached if empty
+	bool build_dag = false; // Merges the identical subtrees, the file is still traced as an octree
+	uint32_t file_version = voxelizer::k_octree_file_version; // The uncompressed version 2 is still readable by older viewers
+	bool bench = false; // Times the CPU queries on the octree written, and checks the SIMD ones against the scalar ones
 
-	if (glfwInit() != GLFW_TRUE)
+	for (int i = 3; i < argc; i++)
 	{
-		fprintf(stderr, "Failed to initialize GLFW\n");
-		fflush(stderr);
-
-		return 1;
+		std::string option = argv[i];
+		if (option == "--cpu")
+		{
+			use_cpu = true;
+		}
+		else if (option == "--max-tile-voxels" && i + 1 < argc)
+		{
+			max_tile_voxels = std::stoull(argv[++i]);
+		}
+		else if (option == "--scene-cache" && i + 1 < argc)
+		{
+			scene_cache_folder = argv[++i];
+		}
+		else if (option == "--dag")
+		{
+			build_dag = true;
+		}
+		else if (option == "--uncompressed")
+		{
+			file_version = 2;
+		}
+		else if (option == "--bench")
+		{
+			bench = true;
+		}
+		else if (option == "--context" && i + 1 < argc)
+		{
+			std::string api = argv[++i];
+			if (api == "egl") context_api = voxelizer::context_api::EGL;
+			else if (api == "glfw") context_api = voxelizer::context_api::GLFW;
+			else
+			{
+				printf("Unknown context API: %s\n", api.c_str());
+				return 4;
+			}
+		}
+		else
+		{
+			printf("Unknown option: %s\n", argv[i]);
+			return 4;
+		}
 	}
 
-	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	std::unique_ptr<voxelizer::context> context;
 
-	GLFWwindow* window = glfwCreateWindow(23, 23 /* We don't care about window dimension */, "voxelizer", nullptr, nullptr);
-	glfwMakeContextCurrent(window);
+	if (!use_cpu)
+	{
+		printf("Initializing OpenGL context\n");
+
+		try
+		{
+			context = std::make_unique<voxelizer::context>(context_api);
+		}
+		catch (std::exception const& exception)
+		{
+			fprintf(stderr, "Failed to initialize the OpenGL context: %s\n", exception.what());
+			fflush(stderr);
+
+			return 1;
+		}
+
+		glEnable(GL_DEBUG_OUTPUT);
+		glDebugMessageCallback(message_callback, nullptr);
+	}
 
-	if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress))
+	try
 	{
-		fprintf(stderr, "Failed to initialize GLAD\n");
-		fflush(stderr);
-		return 2;
+		run_voxelizer(input_file_path, volume_height, output_file_path, use_cpu, max_tile_voxels, scene_cache_folder, build_dag, file_version);
 	}
+	catch (std::exception const& exception)
+	{
+		fprintf(stderr, "Failed to voxelize: %s\n", exception.what());
+		fflush(stderr);
 
-	glEnable(GL_DEBUG_OUTPUT);
-	glDebugMessageCallback(message_callback, nullptr);
+		return 5;
+	}
 
-	run_voxelizer(input_file_path, volume_height, output_file_path);
+	if (bench)
+	{
+		bool is_valid;
+
+		try
+		{
+			is_valid = run_query_bench(output_file_path);
+		}
+		catch (std::exception const& exception)
+		{
+			fprintf(stderr, "Failed to run the benchmark: %s\n", exception.what());
+			fflush(stderr);
+
+			return 6;
+		}
+
+		if (!is_valid)
+		{
+			fprintf(stderr, "The batched queries don't match the scalar ones\n");
+			fflush(stderr);
+
+			return 6;
+		}
+	}
 
 	printf("Bye bye\n");
 
-	glfwDestroyWindow(window);
-	glfwTerminate();
-
 	return 0;
 }
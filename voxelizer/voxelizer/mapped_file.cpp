@@ -0,0 +1,108 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+voxelizer::mapped_file::mapped_file(std::filesystem::path const& path)
+{
+	m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Failed to open the file: " + path.u8string());
+
+	LARGE_INTEGER size{};
+	GetFileSizeEx(m_file, &size);
+	m_size = (size_t) size.QuadPart;
+
+	if (m_size == 0)
+		return;
+
+	m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping != nullptr)
+		m_data = (uint8_t const*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (m_data == nullptr)
+	{
+		if (m_mapping != nullptr)
+			CloseHandle(m_mapping);
+		CloseHandle(m_file);
+
+		throw std::runtime_error("Failed to map the file: " + path.u8string());
+	}
+}
+
+voxelizer::mapped_file::~mapped_file()
+{
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+
+	if (m_mapping != nullptr)
+		CloseHandle(m_mapping);
+
+	CloseHandle(m_file);
+}
+
+void voxelizer::mapped_file::prefetch(size_t offset, size_t size) const
+{
+	// PrefetchVirtualMemory needs Windows 8, the pages are then faulted in on access
+}
+
+#else
+
+voxelizer::mapped_file::mapped_file(std::filesystem::path const& path)
+{
+	m_file = open(path.c_str(), O_RDONLY);
+	if (m_file < 0)
+		throw std::runtime_error("Failed to open the file: " + path.u8string());
+
+	struct stat file_stat{};
+	fstat(m_file, &file_stat);
+	m_size = (size_t) file_stat.st_size;
+
+	if (m_size == 0)
+		return;
+
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+	if (data == MAP_FAILED)
+	{
+		close(m_file);
+
+		throw std::runtime_error("Failed to map the file: " + path.u8string());
+	}
+
+	m_data = (uint8_t const*) data;
+}
+
+voxelizer::mapped_file::~mapped_file()
+{
+	if (m_data != nullptr)
+		munmap((void*) m_data, m_size);
+
+	close(m_file);
+}
+
+void voxelizer::mapped_file::prefetch(size_t offset, size_t size) const
+{
+	if (m_data == nullptr || offset >= m_size)
+		return;
+
+	// madvise wants a page aligned address
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	size_t begin = offset / page_size * page_size;
+	size_t end = std::min(offset + size, m_size);
+
+	madvise((void*) (m_data + begin), end - begin, MADV_WILLNEED);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace voxelizer
+{
+	/// A read-only memory mapping of a whole file, the pages are loaded by the OS as they're accessed (e.g. by the GL
+	/// driver when the mapping is passed to glBufferData).
+	class mapped_file
+	{
+	public:
+		uint8_t const* m_data = nullptr; // Null if the file is empty.
+		size_t m_size = 0;
+
+		explicit mapped_file(std::filesystem::path const& path);
+		mapped_file(mapped_file const&) = delete;
+
+		~mapped_file();
+
+		/// Hints the OS to start reading the given range from disk, without waiting for it.
+		void prefetch(size_t offset, size_t size) const;
+
+	private:
+#ifdef _WIN32
+		void* m_file = nullptr;
+		void* m_mapping = nullptr;
+#else
+		int m_file = -1;
+#endif
+	};
+}
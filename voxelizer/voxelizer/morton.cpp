@@ -0,0 +1,207 @@
+#include "morton.hpp"
+
+#include "simd.hpp"
+
+// ------------------------------------------------------------------------------------------------
+// Scalar
+// ------------------------------------------------------------------------------------------------
+
+void encode_morton_codes_scalar(glm::uvec3 const* positions, size_t count, uint64_t* codes)
+{
+	for (size_t i = 0; i < count; i++)
+		codes[i] = voxelizer::get_morton_code_from_voxel_position(positions[i]);
+}
+
+void decode_morton_codes_scalar(uint64_t const* codes, size_t count, glm::uvec3* positions)
+{
+	for (size_t i = 0; i < count; i++)
+		positions[i] = voxelizer::get_voxel_position_from_morton_code(codes[i]);
+}
+
+#if defined(VOXELIZER_X86)
+
+// ------------------------------------------------------------------------------------------------
+// BMI2
+// ------------------------------------------------------------------------------------------------
+
+#if defined(__x86_64__) || defined(_M_X64) // pdep/pext on 64-bit operands
+
+constexpr uint64_t k_morton_x_mask = 0x1249249249249249;
+
+VOXELIZER_TARGET_BMI2
+void encode_morton_codes_bmi2(glm::uvec3 const* positions, size_t count, uint64_t* codes)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::uvec3 const& position = positions[i];
+		codes[i] =
+			_pdep_u64(position.x, k_morton_x_mask) |
+			_pdep_u64(position.y, k_morton_x_mask << 1) |
+			_pdep_u64(position.z, k_morton_x_mask << 2);
+	}
+}
+
+VOXELIZER_TARGET_BMI2
+void decode_morton_codes_bmi2(uint64_t const* codes, size_t count, glm::uvec3* positions)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t code = codes[i];
+		positions[i] = glm::uvec3(
+			(uint32_t) _pext_u64(code, k_morton_x_mask),
+			(uint32_t) _pext_u64(code, k_morton_x_mask << 1),
+			(uint32_t) _pext_u64(code, k_morton_x_mask << 2)
+		);
+	}
+}
+
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// AVX2
+// ------------------------------------------------------------------------------------------------
+
+VOXELIZER_TARGET_AVX2 VOXELIZER_FORCE_INLINE __m256i spread_morton_bits_avx2(__m256i value)
+{
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi64(value, 32)), _mm256_set1_epi64x(0x001f00000000ffff));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi64(value, 16)), _mm256_set1_epi64x(0x001f0000ff0000ff));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi64(value, 8)), _mm256_set1_epi64x(0x100f00f00f00f00f));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi64(value, 4)), _mm256_set1_epi64x(0x10c30c30c30c30c3));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi64(value, 2)), _mm256_set1_epi64x(0x1249249249249249));
+	return value;
+}
+
+VOXELIZER_TARGET_AVX2 VOXELIZER_FORCE_INLINE __m256i compact_morton_bits_avx2(__m256i value)
+{
+	value = _mm256_and_si256(value, _mm256_set1_epi64x(0x1249249249249249));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_srli_epi64(value, 2)), _mm256_set1_epi64x(0x10c30c30c30c30c3));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_srli_epi64(value, 4)), _mm256_set1_epi64x(0x100f00f00f00f00f));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_srli_epi64(value, 8)), _mm256_set1_epi64x(0x001f0000ff0000ff));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_srli_epi64(value, 16)), _mm256_set1_epi64x(0x001f00000000ffff));
+	value = _mm256_and_si256(_mm256_or_si256(value, _mm256_srli_epi64(value, 32)), _mm256_set1_epi64x(0x1fffff));
+	return value;
+}
+
+// Interleaves the 4 x, y, z (21-bit, in 64-bit lanes)
+VOXELIZER_TARGET_AVX2 VOXELIZER_FORCE_INLINE __m256i encode_morton_avx2(__m256i x, __m256i y, __m256i z)
+{
+	return _mm256_or_si256(
+		spread_morton_bits_avx2(x),
+		_mm256_or_si256(_mm256_slli_epi64(spread_morton_bits_avx2(y), 1), _mm256_slli_epi64(spread_morton_bits_avx2(z), 2))
+	);
+}
+
+// Packs the low words of the 64-bit lanes of lo and hi
+VOXELIZER_TARGET_AVX2 VOXELIZER_FORCE_INLINE __m256i pack_low_words_avx2(__m256i lo, __m256i hi)
+{
+	__m256i const index = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	return _mm256_blend_epi32(_mm256_permutevar8x32_epi32(lo, index), _mm256_permutevar8x32_epi32(hi, index), 0xf0);
+}
+
+VOXELIZER_TARGET_AVX2
+void encode_morton_codes_avx2(glm::uvec3 const* positions, size_t count, uint64_t* codes)
+{
+	// 8 positions (24 words) are loaded in 3 registers, where the components of every axis lie in distinct lanes: they're blended
+	// together and then permuted in order, these are the lanes of the blends holding the components 0 to 7
+	__m256i const x_lanes = _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5);
+	__m256i const y_lanes = _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6);
+	__m256i const z_lanes = _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7);
+	__m256i const mask = _mm256_set1_epi32(0x1fffff);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i const* data = (__m256i const*) &positions[i];
+		__m256i v0 = _mm256_loadu_si256(data);
+		__m256i v1 = _mm256_loadu_si256(data + 1);
+		__m256i v2 = _mm256_loadu_si256(data + 2);
+
+		__m256i x = _mm256_blend_epi32(_mm256_blend_epi32(v0, v1, 0x92), v2, 0x24);
+		__m256i y = _mm256_blend_epi32(_mm256_blend_epi32(v0, v1, 0x24), v2, 0x49);
+		__m256i z = _mm256_blend_epi32(_mm256_blend_epi32(v0, v1, 0x49), v2, 0x92);
+		x = _mm256_and_si256(_mm256_permutevar8x32_epi32(x, x_lanes), mask);
+		y = _mm256_and_si256(_mm256_permutevar8x32_epi32(y, y_lanes), mask);
+		z = _mm256_and_si256(_mm256_permutevar8x32_epi32(z, z_lanes), mask);
+
+		__m256i lo = encode_morton_avx2(
+			_mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)),
+			_mm256_cvtepu32_epi64(_mm256_castsi256_si128(y)),
+			_mm256_cvtepu32_epi64(_mm256_castsi256_si128(z))
+		);
+		__m256i hi = encode_morton_avx2(
+			_mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1)),
+			_mm256_cvtepu32_epi64(_mm256_extracti128_si256(y, 1)),
+			_mm256_cvtepu32_epi64(_mm256_extracti128_si256(z, 1))
+		);
+
+		_mm256_storeu_si256((__m256i*) &codes[i], lo);
+		_mm256_storeu_si256((__m256i*) &codes[i + 4], hi);
+	}
+
+	encode_morton_codes_scalar(positions + i, count - i, codes + i);
+}
+
+VOXELIZER_TARGET_AVX2
+void decode_morton_codes_avx2(uint64_t const* codes, size_t count, glm::uvec3* positions)
+{
+	// The inverse of encode_morton_codes_avx2: the components are permuted to the lanes they have in the 3 registers stored, and
+	// blended, these are the components held by the lanes 0 to 7
+	__m256i const x_lanes = _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5);
+	__m256i const y_lanes = _mm256_setr_epi32(5, 0, 3, 6, 1, 4, 7, 2);
+	__m256i const z_lanes = _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i lo = _mm256_loadu_si256((__m256i const*) &codes[i]);
+		__m256i hi = _mm256_loadu_si256((__m256i const*) &codes[i + 4]);
+
+		__m256i x = pack_low_words_avx2(compact_morton_bits_avx2(lo), compact_morton_bits_avx2(hi));
+		__m256i y = pack_low_words_avx2(compact_morton_bits_avx2(_mm256_srli_epi64(lo, 1)), compact_morton_bits_avx2(_mm256_srli_epi64(hi, 1)));
+		__m256i z = pack_low_words_avx2(compact_morton_bits_avx2(_mm256_srli_epi64(lo, 2)), compact_morton_bits_avx2(_mm256_srli_epi64(hi, 2)));
+		x = _mm256_permutevar8x32_epi32(x, x_lanes);
+		y = _mm256_permutevar8x32_epi32(y, y_lanes);
+		z = _mm256_permutevar8x32_epi32(z, z_lanes);
+
+		__m256i* data = (__m256i*) &positions[i];
+		_mm256_storeu_si256(data, _mm256_blend_epi32(_mm256_blend_epi32(x, y, 0x92), z, 0x24));
+		_mm256_storeu_si256(data + 1, _mm256_blend_epi32(_mm256_blend_epi32(x, y, 0x24), z, 0x49));
+		_mm256_storeu_si256(data + 2, _mm256_blend_epi32(_mm256_blend_epi32(x, y, 0x49), z, 0x92));
+	}
+
+	decode_morton_codes_scalar(codes + i, count - i, positions + i);
+}
+
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// Dispatch
+// ------------------------------------------------------------------------------------------------
+
+// pdep/pext do an axis per instruction and are faster than AVX2 (that needs 64-bit lanes for the codes, so 4 per register),
+// which is left to the CPUs where they're microcoded
+void voxelizer::encode_morton_codes(glm::uvec3 const* positions, size_t count, uint64_t* codes)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	if (voxelizer::simd::has_fast_bmi2())
+		return encode_morton_codes_bmi2(positions, count, codes);
+#endif
+#if defined(VOXELIZER_X86)
+	if (voxelizer::simd::has_avx2())
+		return encode_morton_codes_avx2(positions, count, codes);
+#endif
+	encode_morton_codes_scalar(positions, count, codes);
+}
+
+void voxelizer::decode_morton_codes(uint64_t const* codes, size_t count, glm::uvec3* positions)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	if (voxelizer::simd::has_fast_bmi2())
+		return decode_morton_codes_bmi2(codes, count, positions);
+#endif
+#if defined(VOXELIZER_X86)
+	if (voxelizer::simd::has_avx2())
+		return decode_morton_codes_avx2(codes, count, positions);
+#endif
+	decode_morton_codes_scalar(codes, count, positions);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace voxelizer
+{
+	constexpr uint32_t k_morton_bits_per_axis = 21; // 63 bits out of 64.
+
+	/// Spreads the lowest 21 bits of the value two bits apart (bit i moves to bit 3 * i), the higher ones are dropped.
+	constexpr uint64_t spread_morton_bits(uint32_t value)
+	{
+		uint64_t result = value & 0x1fffff;
+		result = (result | (result << 32)) & 0x001f00000000ffff;
+		result = (result | (result << 16)) & 0x001f0000ff0000ff;
+		result = (result | (result << 8))  & 0x100f00f00f00f00f;
+		result = (result | (result << 4))  & 0x10c30c30c30c30c3;
+		result = (result | (result << 2))  & 0x1249249249249249;
+		return result;
+	}
+
+	/// The inverse of spread_morton_bits: gathers every third bit of the value, from the LSB.
+	constexpr uint32_t compact_morton_bits(uint64_t value)
+	{
+		value &= 0x1249249249249249;
+		value = (value | (value >> 2))  & 0x10c30c30c30c30c3;
+		value = (value | (value >> 4))  & 0x100f00f00f00f00f;
+		value = (value | (value >> 8))  & 0x001f0000ff0000ff;
+		value = (value | (value >> 16)) & 0x001f00000000ffff;
+		value = (value | (value >> 32)) & 0x1fffff;
+		return (uint32_t) value;
+	}
+
+	/// Interleaves the position into a 64-bit Morton code, from the LSB: x, y, z. The 3 bits for the deepest level are the lowest,
+	/// so at level l (of an octree of resolution r) the child index is (morton >> 3 * (r - l)) & 7.
+	constexpr uint64_t get_morton_code_from_voxel_position(glm::uvec3 pos)
+	{
+		return spread_morton_bits(pos.x) | (spread_morton_bits(pos.y) << 1) | (spread_morton_bits(pos.z) << 2);
+	}
+
+	constexpr glm::uvec3 get_voxel_position_from_morton_code(uint64_t morton)
+	{
+		return glm::uvec3(compact_morton_bits(morton), compact_morton_bits(morton >> 1), compact_morton_bits(morton >> 2));
+	}
+
+	/**
+	 * Converts arrays of positions to Morton codes and back, as the functions above. They run with BMI2 (pdep/pext) when the CPU
+	 * has fast ones, with AVX2 otherwise (e.g. AMD before Zen 3, that microcodes pdep/pext).
+	 */
+	void encode_morton_codes(glm::uvec3 const* positions, size_t count, uint64_t* codes);
+	void decode_morton_codes(uint64_t const* codes, size_t count, glm::uvec3* positions);
+}
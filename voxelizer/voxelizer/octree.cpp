@@ -1,5 +1,6 @@
 #include "octree.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
@@ -20,12 +21,17 @@ bool voxelizer::octree::is_valid() const
 
 size_t voxelizer::octree::get_size() const
 {
-	return voxelizer::octree::get_octree_size(m_resolution);
+	return m_capacity;
 }
 
 size_t voxelizer::octree::get_bytesize() const
 {
-	return voxelizer::octree::get_octree_bytesize(m_resolution);
+	return m_capacity * sizeof(GLuint);
+}
+
+size_t voxelizer::octree::get_used_bytesize() const
+{
+	return m_node_count * sizeof(GLuint);
 }
 
 uint32_t voxelizer::octree::get_suitable_resolution_for(glm::vec3 grid)
@@ -39,20 +45,6 @@ uint32_t voxelizer::octree::get_octree_side(uint32_t resolution)
 	return (uint32_t) glm::exp2(resolution);
 }
 
-constexpr size_t voxelizer::octree::get_octree_size(uint32_t resolution)
-{
-	size_t result = 0;
-	for (int level = 1; level <= resolution; level++) {
-		result += (size_t) glm::exp2(3 * level);
-	}
-	return result;
-}
-
-constexpr size_t voxelizer::octree::get_octree_bytesize(uint32_t resolution)
-{
-	return get_octree_size(resolution) * sizeof(GLuint);
-}
-
 bool voxelizer::octree::is_null(uint32_t raw_val)
 {
 	return raw_val == 0;
@@ -73,24 +65,7 @@ uint32_t voxelizer::octree::get_value(uint32_t raw_val)
 	return raw_val & 0x7fffffff;
 }
 
-glm::uvec3 voxelizer::octree::get_voxel_position(uint32_t morton)
-{
-	glm::uvec3 result(0);
-
-	int pos = 0;
-	while (morton != 0)
-	{
-		result.x |= (morton & 1) << pos; morton >>= 1;
-		result.y |= (morton & 1) << pos; morton >>= 1;
-		result.z |= (morton & 1) << pos; morton >>= 1;
-
-		pos++;
-	}
-
-	return result;
-}
-
-void voxelizer::octree::traverse_r(GLuint const* octree, size_t offset, uint32_t depth, voxelizer::octree::on_leaf_t const& on_leaf, uint32_t parent_morton, uint32_t stop_at_lvl)
+void voxelizer::octree::traverse_r(GLuint const* octree, size_t offset, uint32_t depth, voxelizer::octree::on_leaf_t const& on_leaf, uint64_t parent_morton, uint32_t stop_at_lvl)
 {
 	for (int i = 0; i < 8; i++)
 	{
@@ -100,7 +75,7 @@ void voxelizer::octree::traverse_r(GLuint const* octree, size_t offset, uint32_t
 			continue;
 		}
 
-		uint32_t morton = parent_morton | (i << (3 * (depth - 1)));
+		uint64_t morton = (parent_morton << 3) | i;
 		if (voxelizer::octree::is_leaf(raw_val) || depth == stop_at_lvl) {
 			on_leaf(morton, node_idx);
 		} else {
@@ -117,6 +92,128 @@ void voxelizer::octree::traverse(GLuint const* octree, voxelizer::octree::on_lea
 	traverse_r(octree, 0, 1, on_leaf, 0, stop_at_lvl);
 }
 
+void voxelizer::octree::canonicalize(std::vector<GLuint>& octree)
+{
+	if (octree.size() < 8)
+		throw std::invalid_argument("Invalid octree, the root block is missing");
+
+	std::vector<GLuint> result;
+	result.reserve(octree.size());
+
+	// Breadth-first, the blocks are queued (and numbered) in the order they're found
+	std::vector<uint32_t> blocks{0};
+
+	for (size_t block_idx = 0; block_idx < blocks.size(); block_idx++)
+	{
+		uint32_t block = blocks[block_idx];
+		if ((size_t) block + 8 > octree.size())
+			throw std::invalid_argument("Invalid octree, node address out of bounds");
+
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			GLuint raw_val = octree[block + i];
+			if (voxelizer::octree::is_address(raw_val))
+			{
+				result.push_back(0x80000000 | (GLuint) (blocks.size() * 8));
+				blocks.push_back(voxelizer::octree::get_value(raw_val));
+			}
+			else
+			{
+				result.push_back(raw_val);
+			}
+		}
+	}
+
+	octree = std::move(result);
+}
+
+size_t voxelizer::octree::deduplicate(std::vector<GLuint>& octree)
+{
+	// Breadth-first order: block i is at i * 8 and its children come after it
+	canonicalize(octree);
+
+	size_t block_count = octree.size() / 8;
+
+	// Bottom-up, a block is merged once its children have been, so identical subtrees end up with identical blocks. The
+	// unique blocks address their children by unique block index, the final addresses are only known at the end
+	std::vector<GLuint> unique_blocks;
+	unique_blocks.reserve(octree.size());
+
+	std::vector<uint32_t> unique_block_indices(block_count); // Per block.
+
+	// Open addressing, holding the unique block indices
+	size_t table_size = 1;
+	while (table_size < block_count * 2)
+		table_size <<= 1;
+
+	std::vector<uint32_t> table(table_size, UINT32_MAX);
+
+	for (size_t block_idx = block_count; block_idx-- > 0;)
+	{
+		GLuint block[8];
+		uint64_t hash = 0;
+
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			GLuint raw_val = octree[block_idx * 8 + i];
+			if (voxelizer::octree::is_address(raw_val))
+				raw_val = 0x80000000 | unique_block_indices[voxelizer::octree::get_value(raw_val) / 8];
+
+			block[i] = raw_val;
+
+			hash = (hash ^ raw_val) * 0x9e3779b97f4a7c15ull;
+			hash ^= hash >> 29;
+		}
+
+		size_t slot = (size_t) hash & (table_size - 1);
+		uint32_t unique_block_idx = UINT32_MAX;
+
+		// The root is never merged, so that it's the last unique block (i.e. the first one laid out)
+		if (block_idx > 0)
+		{
+			for (; table[slot] != UINT32_MAX; slot = (slot + 1) & (table_size - 1))
+			{
+				if (std::equal(block, block + 8, unique_blocks.begin() + (size_t) table[slot] * 8))
+				{
+					unique_block_idx = table[slot];
+					break;
+				}
+			}
+		}
+
+		if (unique_block_idx == UINT32_MAX)
+		{
+			unique_block_idx = (uint32_t) (unique_blocks.size() / 8);
+			unique_blocks.insert(unique_blocks.end(), block, block + 8);
+
+			if (block_idx > 0)
+				table[slot] = unique_block_idx;
+		}
+
+		unique_block_indices[block_idx] = unique_block_idx;
+	}
+
+	// Laid out in reverse, so that the root is at 0 and the parents precede their children
+	size_t unique_block_count = unique_blocks.size() / 8;
+	octree.resize(unique_blocks.size());
+
+	for (size_t unique_block_idx = 0; unique_block_idx < unique_block_count; unique_block_idx++)
+	{
+		size_t address = (unique_block_count - 1 - unique_block_idx) * 8;
+
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			GLuint raw_val = unique_blocks[unique_block_idx * 8 + i];
+			if (voxelizer::octree::is_address(raw_val))
+				raw_val = 0x80000000 | (GLuint) ((unique_block_count - 1 - voxelizer::octree::get_value(raw_val)) * 8);
+
+			octree[address + i] = raw_val;
+		}
+	}
+
+	return block_count - unique_block_count;
+}
+
 // --------------------------------------------------------------------------------------------------------------------------------
 // octree_traverser
 // --------------------------------------------------------------------------------------------------------------------------------
@@ -153,7 +250,7 @@ voxelizer::octree_traverser::value voxelizer::octree_traverser::next(uint32_t st
 			m_current.m_child_num++;
 		}
 
-		m_current.m_morton_code = (m_current.m_morton_code & (~7)) | m_current.m_child_num;
+		m_current.m_morton_code = (m_current.m_morton_code & ~(uint64_t) 7) | m_current.m_child_num;
 
 		uint32_t raw_val = m_octree[m_current.m_node_address + m_current.m_child_num];
 		uint32_t val = voxelizer::octree::get_value(raw_val);
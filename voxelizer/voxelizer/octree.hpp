@@ -8,23 +8,10 @@
 #include <glm/glm.hpp>
 
 #include "gl.hpp"
+#include "morton.hpp"
 
 namespace voxelizer
 {
-	constexpr uint32_t get_morton_code_from_voxel_position(glm::uvec3 pos)
-	{
-		uint32_t morton = 0;
-
-		while (pos.x != 0 || pos.y != 0 || pos.z != 0)
-		{
-			morton |= pos.x & 1; pos.x >>= 1; morton <<= 1;
-			morton |= pos.y & 1; pos.y >>= 1; morton <<= 1;
-			morton |= pos.z & 1; pos.z >>= 1; morton <<= 1;
-		}
-
-		return morton;
-	}
-
 	// ------------------------------------------------------------------------------------------------
 	// octree
 	// ------------------------------------------------------------------------------------------------
@@ -34,27 +21,55 @@ namespace voxelizer
 		GLuint m_buffer = NULL;
 		size_t m_offset;
 		uint32_t m_resolution;
+		uint32_t m_capacity = 0;   // The nodes the buffer can hold (from m_offset).
+		uint32_t m_node_count = 0; // The nodes actually allocated (from the start of the buffer), set by the octree_builder.
 
 		bool is_valid() const;
 
-		size_t get_size() const;
-		size_t get_bytesize() const;
+		size_t get_size() const;     // The capacity, in nodes.
+		size_t get_bytesize() const; // The capacity, in bytes.
+		size_t get_used_bytesize() const;
 
 		static uint32_t get_suitable_resolution_for(glm::vec3 grid);
 		static uint32_t get_octree_side(uint32_t resolution);
-		static constexpr size_t get_octree_size(uint32_t resolution);
-		static constexpr size_t get_octree_bytesize(uint32_t resolution);
+		static constexpr size_t get_octree_size(uint32_t resolution)
+		{
+			size_t result = 0;
+			for (uint32_t level = 1; level <= resolution; level++) {
+				result += (size_t) 1 << (3 * level);
+			}
+			return result;
+		}
+
+		static constexpr size_t get_octree_bytesize(uint32_t resolution)
+		{
+			return get_octree_size(resolution) * sizeof(GLuint);
+		}
 
 		static bool is_null(uint32_t raw_val);
 		static bool is_leaf(uint32_t raw_val);
 		static bool is_address(uint32_t raw_val);
 		static uint32_t get_value(uint32_t raw_val);
 
-		static glm::uvec3 get_voxel_position(uint32_t morton);
+		static constexpr glm::uvec3 get_voxel_position(uint64_t morton)
+		{
+			return get_voxel_position_from_morton_code(morton);
+		}
 
-		using on_leaf_t = std::function<void(uint32_t morton, uint32_t node_idx)>;
-		static void traverse_r(GLuint const* octree, size_t offset, uint32_t depth, voxelizer::octree::on_leaf_t const& on_leaf, uint32_t parent_morton = 0, uint32_t stop_at_lvl = 0);
+		/// The Morton code is relative to the level of the node: at the leaf level it's the voxel position (see get_voxel_position).
+		using on_leaf_t = std::function<void(uint64_t morton, uint32_t node_idx)>;
+		static void traverse_r(GLuint const* octree, size_t offset, uint32_t depth, voxelizer::octree::on_leaf_t const& on_leaf, uint64_t parent_morton = 0, uint32_t stop_at_lvl = 0);
 		static void traverse(GLuint const* octree, voxelizer::octree::on_leaf_t const& on_leaf, uint32_t stop_at_lvl = 0);
+
+		/// Lays out the blocks level by level, every level in the order of the parent nodes (so by Morton code), dropping the
+		/// unreachable ones. Octrees with the same content are then byte-identical, whatever builder allocated them.
+		static void canonicalize(std::vector<GLuint>& octree);
+
+		/// Merges the identical subtrees (same structure and leaf colors) so that each one is stored once: blocks may then be
+		/// shared by several parents and the octree becomes a DAG. It's traversed as before (traverse, svo_tracer.frag), the
+		/// root block stays at 0 and the parents precede their children. canonicalize expands a DAG back into a tree.
+		/// Returns the blocks merged.
+		static size_t deduplicate(std::vector<GLuint>& octree);
 	};
 
 	using octree_data_t = GLuint;
@@ -71,13 +86,12 @@ namespace voxelizer
 		uint32_t m_resolution;
 		std::vector<_voxel> m_data;
 
-		uint32_t get_offset_from_morton_code(uint32_t morton)
+		uint32_t get_offset_from_morton_code(uint64_t morton)
 		{
 			uint32_t off = 0;
-			for (int i = 0; i < m_resolution; i++)
+			for (uint32_t level = 1; level < m_resolution; level++)
 			{
-				off = m_data[off + (morton & 7)];
-				morton >>= 3;
+				off = octree::get_value(m_data[off + ((morton >> (3 * (m_resolution - level))) & 7)]);
 			}
 			return off + (morton & 7);
 		}
@@ -95,14 +109,14 @@ namespace voxelizer
 
 		_voxel& get_voxel(glm::uvec3 const& pos) const
 		{
-			uint32_t morton = get_morton_code_from_voxel_position(pos);
+			uint64_t morton = get_morton_code_from_voxel_position(pos);
 			uint32_t off = get_offset_from_morton_code(morton);
 			return m_data.at(off);
 		}
 
 		void set_voxel(glm::uvec3 const& pos, _voxel&& voxel)
 		{
-			uint32_t morton = get_morton_code_from_voxel_position(pos);
+			uint64_t morton = get_morton_code_from_voxel_position(pos);
 			uint32_t off = get_offset_from_morton_code(morton);
 			m_data[off] = std::move(voxel);
 		}
@@ -117,7 +131,7 @@ namespace voxelizer
 	public:
 		struct value
 		{
-			uint32_t m_morton_code;  // The morton_code for the current node obtained during exploration.
+			uint64_t m_morton_code;  // The morton_code for the current node obtained during exploration.
 			uint32_t m_node_address; // The address of the node within the octree buffer.
 			uint32_t m_child_num;    // The index of the node within its parent, so [0-7].
 		};
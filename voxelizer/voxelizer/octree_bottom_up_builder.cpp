@@ -0,0 +1,116 @@
+#include "octree_bottom_up_builder.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+#include <shinji.hpp>
+
+voxelizer::octree_bottom_up_builder::octree_bottom_up_builder()
+{
+	std::pair<program*, char const*> programs[]{
+		{&m_count, "resources/shaders/svo_bottom_up_count.comp"},
+		{&m_write, "resources/shaders/svo_bottom_up_write.comp"},
+	};
+
+	for (auto& [program, path] : programs)
+	{
+		shader shader(GL_COMPUTE_SHADER);
+		shader.source_from_string(shinji::load_resource_from_bundle(path).m_data);
+		shader.compile();
+
+		program->attach_shader(shader);
+		program->link();
+	}
+
+	glGenBuffers(1, &m_counters);
+}
+
+voxelizer::octree_bottom_up_builder::~octree_bottom_up_builder()
+{
+	glDeleteBuffers(1, &m_counters);
+}
+
+void voxelizer::octree_bottom_up_builder::build(
+	voxelizer::voxel_list& voxel_list,
+	uint32_t resolution,
+	voxelizer::octree& octree
+)
+{
+	if (resolution == 0 || resolution > voxelizer::k_morton_bits_per_axis)
+		throw std::invalid_argument("Invalid octree resolution, must be between 1 and 21");
+
+	size_t count = voxel_list.m_size;
+	size_t group_count = (count + k_group_size - 1) / k_group_size;
+
+	m_voxel_list_dedup.sort(voxel_list, resolution * 3);
+
+	GLuint block_count = 1; // The root block, even if the octree is empty.
+
+	if (count > 0)
+	{
+		size_t counter_count = group_count * resolution;
+		if (counter_count > m_counter_capacity)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counters);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (counter_count * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+			m_counter_capacity = counter_count;
+		}
+
+		// count
+		m_count.use();
+
+		glUniform1ui(m_count.get_uniform_location("u_count"), (GLuint) count);
+		glUniform1ui(m_count.get_uniform_location("u_group_count"), (GLuint) group_count);
+		glUniform1i(m_count.get_uniform_location("u_max_level"), (GLint) resolution);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, voxel_list.m_position_buffer.m_buffer_name);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_counters);
+
+		dispatch_compute_1d(count, k_group_size);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// The counters are level-major, so the blocks are numbered level after level (as the octree_builder allocates them)
+		block_count = m_prefix_sum(m_counters, counter_count, true);
+	}
+
+	if ((size_t) block_count * 8 > 0x7fffffff)
+		throw std::runtime_error("Octree too large, node addresses exceed 31 bits");
+
+	GLuint node_count = block_count * 8;
+
+	octree.m_offset = 0;
+	octree.m_resolution = resolution;
+	octree.m_capacity = node_count;
+	octree.m_node_count = node_count;
+
+	glGenBuffers(1, &octree.m_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree.m_buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (node_count * sizeof(GLuint)), nullptr, NULL);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (count > 0)
+	{
+		// write
+		m_write.use();
+
+		glUniform1ui(m_write.get_uniform_location("u_count"), (GLuint) count);
+		glUniform1ui(m_write.get_uniform_location("u_group_count"), (GLuint) group_count);
+		glUniform1i(m_write.get_uniform_location("u_max_level"), (GLint) resolution);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, octree.m_buffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, voxel_list.m_position_buffer.m_buffer_name);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, voxel_list.m_color_buffer.m_buffer_name);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_counters);
+
+		dispatch_compute_1d(count, k_group_size);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		program::unuse();
+	}
+
+	printf("[octree_bottom_up_builder] Octree built - resolution: %d, voxels: %zu, nodes: %d\n", resolution, count, node_count);
+}
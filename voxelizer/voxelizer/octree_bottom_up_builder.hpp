@@ -0,0 +1,44 @@
+#pragma once
+
+#include "gl.hpp"
+#include "octree.hpp"
+#include "prefix_sum.hpp"
+#include "voxel_list.hpp"
+#include "voxel_list_dedup.hpp"
+
+namespace voxelizer
+{
+	/// Builds the octree bottom-up from the voxel-list sorted by Morton code, instead of one flag/alloc/init cycle per level
+	/// (see octree_builder). The nodes of a level are the distinct prefixes of the Morton codes: they're counted per workgroup
+	/// and level, numbered with a prefix sum, and then all the levels are written in a single pass.
+	///
+	/// The octree has the same encoding, and the same level-by-level block layout, of the octree_builder's.
+	class octree_bottom_up_builder
+	{
+	private:
+		voxelizer::voxel_list_dedup m_voxel_list_dedup; // For the sort.
+		voxelizer::prefix_sum m_prefix_sum;
+
+		program m_count;
+		program m_write;
+
+		GLuint m_counters = 0; // [level * group count + group]
+		size_t m_counter_capacity = 0;
+
+	public:
+		static constexpr size_t k_group_size = 256;
+
+		octree_bottom_up_builder();
+		octree_bottom_up_builder(octree_bottom_up_builder const&) = delete;
+		~octree_bottom_up_builder();
+
+		/// Builds the octree in a buffer allocated for the exact node count, owned by the caller (result.m_buffer).
+		/// The voxel-list is sorted in place. Voxels with the same position aren't merged, the first one (in the voxel-list)
+		/// is kept: run voxel_list_dedup first to average them.
+		void build(
+			voxelizer::voxel_list& voxel_list,
+			uint32_t resolution,
+			octree& result
+		);
+	};
+}
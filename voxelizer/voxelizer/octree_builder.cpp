@@ -1,11 +1,16 @@
 #include "octree_builder.hpp"
 
+#include <cstddef>
 #include <iostream>
+#include <stdexcept>
 
 #include <shinji.hpp>
 
 #include "render_doc.hpp"
 
+// The node addresses are stored in 31 bits
+constexpr size_t k_max_node_count = 0x7fffffff;
+
 voxelizer::octree_builder::octree_builder()
 {
 	// node_flag
@@ -47,6 +52,29 @@ voxelizer::octree_builder::octree_builder()
 		m_store_leaf.attach_shader(shader);
 		m_store_leaf.link();
 	}
+
+	// level_advance
+	{
+		shader shader(GL_COMPUTE_SHADER);
+		shader.source_from_string(shinji::load_resource_from_bundle("resources/shaders/svo_level_advance.comp").m_data);
+		shader.compile();
+
+		m_level_advance.attach_shader(shader);
+		m_level_advance.link();
+	}
+
+	glGenBuffers(1, &m_build_state);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_build_state);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(build_state), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glGenBuffers(1, &m_voxel_nodes);
+}
+
+voxelizer::octree_builder::~octree_builder()
+{
+	glDeleteBuffers(1, &m_build_state);
+	glDeleteBuffers(1, &m_voxel_nodes);
 }
 
 void voxelizer::octree_builder::clear(voxelizer::octree const& octree, uint32_t start, uint32_t count)
@@ -57,12 +85,13 @@ void voxelizer::octree_builder::clear(voxelizer::octree const& octree, uint32_t
 
 	glUniform1ui(m_node_init.get_uniform_location("u_start"), start);
 	glUniform1ui(m_node_init.get_uniform_location("u_count"), count);
+	glUniform1i(m_node_init.get_uniform_location("u_use_build_state"), GL_FALSE);
 
 	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, octree.m_buffer, (GLintptr)octree.m_offset, (GLintptr)octree.get_bytesize());
 
 	voxelizer::renderdoc::watch(false, [&]
 	{
-		glDispatchCompute(glm::ceil(count / float(32)), 1, 1);
+		dispatch_compute_1d(count, 32);
 		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	});
 
@@ -80,93 +109,229 @@ void voxelizer::octree_builder::build(
 	octree.m_buffer = buffer;
 	octree.m_offset = offset;
 	octree.m_resolution = resolution;
+	// The dense octree exceeds the addressable nodes from resolution 11, the build then fails if it actually doesn't fit
+	octree.m_capacity = (uint32_t) glm::min(voxelizer::octree::get_octree_size(resolution), k_max_node_count);
+
+	build_levels(voxel_list, octree, false);
+}
+
+void voxelizer::octree_builder::build(
+	voxelizer::voxel_list const& voxel_list,
+	uint32_t resolution,
+	voxelizer::octree& octree
+)
+{
+	octree.m_buffer = NULL;
+	octree.m_offset = 0;
+	octree.m_resolution = resolution;
+	octree.m_capacity = 0;
+
+	// A surface of N voxels roughly takes 8 * N / 4 leaf nodes (4 voxels per leaf block), plus the upper levels
+	size_t estimate = glm::max<size_t>(voxel_list.m_size * 4, 8 * 64);
+	reserve(octree, (uint32_t) glm::min(glm::min(estimate, voxelizer::octree::get_octree_size(resolution)), k_max_node_count), 0);
+
+	build_levels(voxel_list, octree, true);
+}
+
+void voxelizer::octree_builder::reserve(voxelizer::octree& octree, uint32_t capacity, uint32_t used_count)
+{
+	if (capacity <= octree.m_capacity)
+		return;
 
-	atomic_counter alloc_counter{};
+	if (capacity > k_max_node_count)
+		throw std::runtime_error("Octree too large, node addresses exceed 31 bits");
 
-	unsigned int start = 0, count = 8;
-	unsigned int alloc_start = start + count;
+	printf("[octree_builder] Growing the octree buffer - capacity: %d -> %d nodes (~%.1f MB)\n",
+		octree.m_capacity,
+		capacity,
+		(float) (capacity * sizeof(GLuint)) / (1024 * 1024)
+	);
 
-	// node init
-	clear(octree, start, count);
+	GLuint buffer{};
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (capacity * sizeof(GLuint)), nullptr, NULL);
 
-	for (int level = 1; level < resolution; level++)
+	if (octree.m_buffer != NULL)
 	{
-		printf("[octree_builder] Level: %d\n", level);
+		if (used_count > 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, octree.m_buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) octree.m_offset, 0, (GLsizeiptr) (used_count * sizeof(GLuint)));
 
-		// node flag
-		m_node_flag.use();
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
 
-		glUniform1i(m_node_flag.get_uniform_location("u_max_level"), (int)octree.m_resolution);
-		glUniform1i(m_node_flag.get_uniform_location("u_level"), level);
+		glDeleteBuffers(1, &octree.m_buffer);
+	}
 
-		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, octree.m_buffer, (GLintptr)octree.m_offset, (GLintptr)octree.get_bytesize());
-		voxel_list.bind(2, 3);
+	octree.m_buffer = buffer;
+	octree.m_offset = 0;
+	octree.m_capacity = capacity;
+}
 
-		glDispatchCompute(glm::ceil(float(voxel_list.m_size) / float(32)), 1, 1);
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+void voxelizer::octree_builder::build_levels(
+	voxelizer::voxel_list const& voxel_list,
+	voxelizer::octree& octree,
+	bool can_grow
+)
+{
+	if (octree.m_resolution > voxelizer::k_morton_bits_per_axis)
+		throw std::invalid_argument("Octree resolution too large, voxel positions have at most 21 bits per axis");
 
-		program::unuse();
+	if (m_voxel_node_capacity < voxel_list.m_size)
+	{
+		m_voxel_node_capacity = voxel_list.m_size;
 
-		printf("[octree_builder] Flagging - max_level: %d, level: %d, octree offset: %zu, octree size: %zu\n", octree.m_resolution, level, octree.m_offset, octree.get_bytesize());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_voxel_nodes);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (m_voxel_node_capacity * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
 
-		// node alloc
-		m_node_alloc.use();
+	// The first level, the root block
+	build_state state{};
+	state.m_start = 0;
+	state.m_count = 8;
+	state.m_alloc_start = state.m_start + state.m_count;
+
+	clear(octree, state.m_start, state.m_count);
+
+	GLint max_workgroup_count_x{};
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_workgroup_count_x);
+
+	// The workgroups of a dispatch over the nodes of the level, as svo_level_advance.comp computes them
+	auto set_level_dispatch = [&]()
+	{
+		uint32_t workgroup_count = (state.m_count + 31) / 32;
+		uint32_t x = glm::min(workgroup_count, (uint32_t) max_workgroup_count_x);
+		uint32_t y = x > 0 ? (workgroup_count + x - 1) / x : 0;
+		state.m_level_dispatch = glm::uvec4(x, y, 1, 0);
+	};
+
+	set_level_dispatch();
+
+	uint32_t level = 1;
 
-		glUniform1ui(m_node_alloc.get_uniform_location("u_start"), start);
-		glUniform1ui(m_node_alloc.get_uniform_location("u_count"), count);
-		glUniform1ui(m_node_alloc.get_uniform_location("u_alloc_start"), alloc_start);
+	// All the levels are recorded at once, the GPU keeps the bookkeeping. The state is read back only at the end: if a level
+	// didn't fit the buffer it's grown and the build resumes from that level.
+	while (true)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_build_state);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(build_state), &state);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		record_levels(voxel_list, octree, level, (uint32_t) max_workgroup_count_x);
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_build_state);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(build_state), &state);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		if (!state.m_overflow)
+			break;
+
+		if (!can_grow)
+			throw std::runtime_error("Octree buffer too small");
+
+		// The nodes up to the level are kept, the level itself is cleared once the buffer is grown
+		uint32_t capacity = (uint32_t) glm::min<size_t>(glm::max<size_t>(state.m_alloc_start, (size_t) octree.m_capacity * 3 / 2), k_max_node_count);
+		reserve(octree, capacity, state.m_start);
+
+		state.m_overflow = 0;
+		set_level_dispatch();
+
+		clear(octree, state.m_start, state.m_count);
+
+		level = state.m_overflow_level + 1;
+	}
+
+	octree.m_node_count = state.m_alloc_start;
+
+	printf("[octree_builder] Store leaves - max_level: %d, octree offset: %zu, octree size: %zu, used nodes: %d\n",
+		octree.m_resolution,
+		octree.m_offset,
+		octree.get_bytesize(),
+		octree.m_node_count
+	);
+}
+
+void voxelizer::octree_builder::record_levels(
+	voxelizer::voxel_list const& voxel_list,
+	voxelizer::octree const& octree,
+	uint32_t first_level,
+	uint32_t max_workgroup_count_x
+)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_build_state);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_voxel_nodes);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_build_state);
+
+	GLintptr level_dispatch_offset = (GLintptr) offsetof(build_state, m_level_dispatch);
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, octree.m_buffer, (GLintptr)octree.m_offset, (GLintptr)octree.get_bytesize());
+	voxel_list.bind(2, 3);
+
+	// The constants of the build are set once, only the level changes from pass to pass
+	glProgramUniform1i(m_node_flag.m_name, m_node_flag.get_uniform_location("u_max_level"), (int)octree.m_resolution);
+	glProgramUniform1ui(m_node_flag.m_name, m_node_flag.get_uniform_location("u_voxel_count"), (GLuint) voxel_list.m_size);
+
+	glProgramUniform1ui(m_level_advance.m_name, m_level_advance.get_uniform_location("u_capacity"), octree.m_capacity);
+	glProgramUniform1ui(m_level_advance.m_name, m_level_advance.get_uniform_location("u_max_workgroup_count"), max_workgroup_count_x);
+
+	glProgramUniform1i(m_node_init.m_name, m_node_init.get_uniform_location("u_use_build_state"), GL_TRUE);
+
+	GLint node_flag_level_location = m_node_flag.get_uniform_location("u_level");
+	GLint level_advance_level_location = m_level_advance.get_uniform_location("u_level");
+
+	for (uint32_t level = first_level; level < octree.m_resolution; level++)
+	{
+		printf("[octree_builder] Level: %d\n", level);
+
+		// node flag
+		m_node_flag.use();
+		glUniform1i(node_flag_level_location, level);
 
-		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, octree.m_buffer, (GLintptr)octree.m_offset, (GLintptr)octree.get_bytesize());
-		alloc_counter.bind(2);
+		dispatch_compute_1d(voxel_list.m_size, 32);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-		alloc_counter.set_value(0);
+		// node alloc, over the nodes of the level
+		m_node_alloc.use();
 
 		renderdoc::watch(false, [&]
 		{
-			glDispatchCompute(glm::ceil(count / float(32)), 1, 1);
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+			glDispatchComputeIndirect(level_dispatch_offset);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 		});
 
-		program::unuse();
-
-		GLuint alloc_count = alloc_counter.get_value();
-		start = alloc_start;
-		count = alloc_count * 8;
-		alloc_start = start + count;
+		// level advance, the allocated level becomes the current one
+		m_level_advance.use();
+		glUniform1i(level_advance_level_location, level);
 
-		printf("[octree_builder] Node alloc - start: %d, count: %d, alloc_start: %d, octree offset: %zu, octree size: %zu\n",
-			start,
-			count,
-			alloc_start,
-			octree.m_offset,
-			octree.get_bytesize()
-		);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
 
 		// node init
-		clear(octree, start, count);
+		m_node_init.use();
+
+		glDispatchComputeIndirect(level_dispatch_offset);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	}
 
 	// store leaf
 	m_store_leaf.use();
 
 	glUniform1i(m_store_leaf.get_uniform_location("u_max_level"), octree.m_resolution);
-
-	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, octree.m_buffer, (GLintptr)octree.m_offset, (GLintptr)octree.get_bytesize());
-	voxel_list.bind(2, 3);
-
-	int workgroup_count = glm::ceil(voxel_list.m_size / float(32));
+	glUniform1ui(m_store_leaf.get_uniform_location("u_voxel_count"), (GLuint) voxel_list.m_size);
 
 	renderdoc::watch(true, [&] {
-		glDispatchCompute(workgroup_count, 1, 1);
+		dispatch_compute_1d(voxel_list.m_size, 32);
 		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	});
 
-
-	printf("[octree_builder] Store leaves - max_level: %d, octree offset: %zu, octree size: %zu\n",
-		octree.m_resolution,
-		octree.m_offset,
-		octree.get_bytesize()
-	);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
 
 	program::unuse();
 }
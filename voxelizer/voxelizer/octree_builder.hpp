@@ -13,9 +13,35 @@ namespace voxelizer
 		program m_node_alloc;
 		program m_node_init;
 		program m_store_leaf;
+		program m_level_advance;
+
+		struct build_state // Same layout as ssbo_build_state (svo_level_advance.comp).
+		{
+			GLuint m_start;
+			GLuint m_count;
+			GLuint m_alloc_start;
+			GLuint m_alloc_count;
+			GLuint m_overflow;
+			GLuint m_overflow_level;
+			GLuint m_padding[2];
+			glm::uvec4 m_level_dispatch;
+		};
+
+		GLuint m_build_state;
+
+		GLuint m_voxel_nodes; // For every voxel, its block at the level being built (GLuint).
+		size_t m_voxel_node_capacity = 0;
+
+		void reserve(voxelizer::octree& octree, uint32_t capacity, uint32_t used_count);
+		void build_levels(voxelizer::voxel_list const& voxel_list, voxelizer::octree& octree, bool can_grow);
+
+		/// Records the passes of the levels from first_level, up to storing the leaves, without waiting for the GPU.
+		void record_levels(voxelizer::voxel_list const& voxel_list, voxelizer::octree const& octree, uint32_t first_level, uint32_t max_workgroup_count_x);
 
 	public:
 		octree_builder();
+		octree_builder(octree_builder const&) = delete;
+		~octree_builder();
 
 		void clear(
 			voxelizer::octree const& octree,
@@ -30,5 +56,13 @@ namespace voxelizer
 			size_t offset,
 			octree& result
 		);
+
+		/// Builds the octree in a buffer allocated by the builder, grown (and the build resumed) when a level doesn't fit.
+		/// The buffer is owned by the caller (result.m_buffer) and may be larger than the used nodes (result.m_node_count).
+		void build(
+			voxelizer::voxel_list const& voxel_list,
+			uint32_t resolution,
+			octree& result
+		);
 	};
 }
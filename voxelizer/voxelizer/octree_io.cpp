@@ -0,0 +1,587 @@
+#include "octree_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#include <zlib.h>
+
+#include "gl.hpp"
+#include "parallel.hpp"
+
+bool is_little_endian()
+{
+	uint16_t test = 0x0001;
+	char* test_ptr = (char*)&test;
+	return test_ptr[0];
+}
+
+uint32_t swap_binary(uint32_t value)
+{
+	std::uint32_t tmp = ((value << 8) & 0xFF00FF00) | ((value >> 8) & 0xFF00FF);
+	return (tmp << 16) | (tmp >> 16);
+}
+
+uint32_t read_u32(uint8_t const* data)
+{
+	uint32_t value{};
+	std::memcpy(&value, data, sizeof(uint32_t));
+	return is_little_endian() ? value : swap_binary(value);
+}
+
+std::vector<GLuint> voxelizer::download_octree(voxelizer::octree const& octree)
+{
+	std::vector<GLuint> result(octree.m_node_count);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree.m_buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr) octree.m_offset, (GLsizeiptr) octree.get_used_bytesize(), result.data());
+
+	return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Chunk compression (version 3)
+// ------------------------------------------------------------------------------------------------
+
+std::vector<uint8_t> compress_chunk(GLuint const* nodes, size_t count)
+{
+	// Byte planes, from the least significant: the same byte of consecutive nodes is much more alike than consecutive bytes
+	std::vector<uint8_t> planes(count * sizeof(GLuint));
+	for (size_t i = 0; i < count; i++)
+	{
+		for (uint32_t b = 0; b < sizeof(GLuint); b++)
+			planes[b * count + i] = (uint8_t) (nodes[i] >> (8 * b));
+	}
+
+	uLongf size = compressBound((uLong) planes.size());
+	std::vector<uint8_t> result(size);
+
+	if (compress2(result.data(), &size, planes.data(), (uLong) planes.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+		throw std::runtime_error("Failed to compress the octree");
+
+	result.resize(size);
+	return result;
+}
+
+void decompress_chunk(uint8_t const* data, size_t size, GLuint* nodes, size_t count)
+{
+	std::vector<uint8_t> planes(count * sizeof(GLuint));
+
+	uLongf planes_size = (uLongf) planes.size();
+	if (uncompress(planes.data(), &planes_size, data, (uLong) size) != Z_OK || planes_size != planes.size())
+		throw std::runtime_error("Corrupted octree file chunk");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		nodes[i] = (GLuint) planes[i]
+			| (GLuint) planes[count + i] << 8
+			| (GLuint) planes[2 * count + i] << 16
+			| (GLuint) planes[3 * count + i] << 24;
+	}
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writing
+// ------------------------------------------------------------------------------------------------
+
+// The chunks the octree is written in, when streamed from the GPU
+constexpr size_t k_write_chunk_size = 16 << 20;
+constexpr uint32_t k_write_chunk_count = 3;
+
+static_assert(k_write_chunk_size % (voxelizer::k_octree_file_chunk_node_count * sizeof(GLuint)) == 0, "The write chunks must hold whole compressed chunks");
+
+/// Writes the octree file with a few large writes (pwrite where available). Uncompressed nodes are written straight from
+/// the caller memory on little-endian hosts, compressed ones are deflated in parallel and the chunk table written at the end.
+class octree_file_writer
+{
+public:
+	octree_file_writer(
+		std::filesystem::path const& path,
+		glm::uvec3 const& volume_size,
+		uint32_t resolution,
+		size_t node_count,
+		uint32_t version
+	) :
+		m_path(path),
+		m_compressed(version >= 3)
+	{
+		if (version < 2 || version > voxelizer::k_octree_file_version)
+			throw std::invalid_argument("Unsupported octree file version: " + std::to_string(version));
+
+		// Version 2 stores the bytesize in 32 bits, version 3 the node count (addresses have 31 bits anyway). Checked before
+		// opening, so that an existing file isn't truncated
+		size_t max_node_count = m_compressed ? UINT32_MAX : UINT32_MAX / sizeof(GLuint);
+		if (node_count > max_node_count)
+			throw std::invalid_argument("Too many nodes for octree file version " + std::to_string(version) + ": " + std::to_string(node_count));
+
+#ifdef _WIN32
+		m_stream.open(path, std::ios::binary);
+		if (!m_stream)
+			throw std::runtime_error("Failed to open the output file: " + path.u8string());
+#else
+		m_file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (m_file < 0)
+			throw std::runtime_error("Failed to open the output file: " + path.u8string());
+#endif
+
+		// The destructor doesn't run if the constructor throws, the file is closed here
+		try
+		{
+			write_header(volume_size, resolution, node_count, version);
+		}
+		catch (...)
+		{
+			close_file();
+			throw;
+		}
+	}
+
+	octree_file_writer(octree_file_writer const&) = delete;
+
+	~octree_file_writer()
+	{
+		close_file();
+	}
+
+	/// The nodes are appended in order. When compressing, every call but the last must pass whole chunks.
+	void write_nodes(GLuint const* nodes, size_t count)
+	{
+		if (!m_compressed)
+		{
+			write_words(nodes, count);
+			return;
+		}
+
+		size_t const chunk_node_count = voxelizer::k_octree_file_chunk_node_count;
+		size_t chunk_count = (count + chunk_node_count - 1) / chunk_node_count;
+
+		// A group of chunks per round, so that the compressed data held is bounded
+		uint32_t thread_count = voxelizer::get_thread_count();
+
+		for (size_t group_begin = 0; group_begin < chunk_count; group_begin += thread_count)
+		{
+			size_t group_size = std::min<size_t>(thread_count, chunk_count - group_begin);
+			std::vector<std::vector<uint8_t>> compressed_chunks(group_size);
+
+			voxelizer::parallel_for(group_size, thread_count, [&](size_t begin, size_t end, uint32_t)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					size_t first_node = (group_begin + i) * chunk_node_count;
+					compressed_chunks[i] = compress_chunk(nodes + first_node, std::min(chunk_node_count, count - first_node));
+				}
+			});
+
+			for (std::vector<uint8_t> const& compressed_chunk : compressed_chunks)
+			{
+				write(compressed_chunk.data(), compressed_chunk.size());
+				m_chunk_sizes.push_back((uint32_t) compressed_chunk.size());
+			}
+		}
+	}
+
+	void finish()
+	{
+		if (m_chunk_sizes.size() != m_chunk_count)
+			throw std::logic_error("Not all the octree nodes were written");
+
+		if (!is_little_endian())
+		{
+			for (uint32_t& size : m_chunk_sizes)
+				size = swap_binary(size);
+		}
+
+		write_at(m_chunk_table_offset, m_chunk_sizes.data(), m_chunk_sizes.size() * sizeof(uint32_t));
+	}
+
+private:
+	void write_header(glm::uvec3 const& volume_size, uint32_t resolution, size_t node_count, uint32_t version)
+	{
+		std::vector<uint32_t> header{
+			version,
+			volume_size.x,
+			volume_size.y,
+			volume_size.z,
+			resolution,
+			(uint32_t) (m_compressed ? node_count : node_count * sizeof(GLuint))
+		};
+
+		if (m_compressed)
+		{
+			m_chunk_count = (node_count + voxelizer::k_octree_file_chunk_node_count - 1) / voxelizer::k_octree_file_chunk_node_count;
+
+			header.push_back(voxelizer::k_octree_file_chunk_node_count);
+			header.push_back((uint32_t) m_chunk_count);
+		}
+
+		write_words(header.data(), header.size());
+
+		// The chunk table, filled by finish()
+		m_chunk_table_offset = m_offset;
+		m_chunk_sizes.reserve(m_chunk_count);
+
+		std::vector<uint32_t> chunk_table(m_chunk_count, 0);
+		write_words(chunk_table.data(), chunk_table.size());
+	}
+
+	void close_file()
+	{
+#ifdef _WIN32
+		m_stream.close();
+#else
+		if (m_file >= 0)
+			close(m_file);
+		m_file = -1;
+#endif
+	}
+
+	/// Writes the words as little-endian.
+	void write_words(uint32_t const* words, size_t count)
+	{
+		if (is_little_endian())
+		{
+			write(words, count * sizeof(uint32_t));
+			return;
+		}
+
+		size_t const chunk = k_write_chunk_size / sizeof(uint32_t);
+		m_swapped_words.resize(std::min(count, chunk));
+
+		for (size_t begin = 0; begin < count; begin += chunk)
+		{
+			size_t end = std::min(begin + chunk, count);
+			for (size_t i = begin; i < end; i++)
+				m_swapped_words[i - begin] = swap_binary(words[i]);
+
+			write(m_swapped_words.data(), (end - begin) * sizeof(uint32_t));
+		}
+	}
+
+	void write(void const* data, size_t size)
+	{
+		write_at(m_offset, data, size);
+		m_offset += size;
+	}
+
+	void write_at(size_t offset, void const* data, size_t size)
+	{
+#ifdef _WIN32
+		m_stream.seekp((std::streamoff) offset);
+		m_stream.write((char const*) data, size);
+		if (!m_stream)
+			throw std::runtime_error("Failed to write the output file: " + m_path.u8string());
+#else
+		while (size > 0)
+		{
+			ssize_t written = pwrite(m_file, data, size, (off_t) offset);
+			if (written < 0 && errno == EINTR)
+				continue;
+
+			if (written <= 0)
+				throw std::runtime_error("Failed to write the output file: " + m_path.u8string());
+
+			data = (uint8_t const*) data + written;
+			size -= (size_t) written;
+			offset += (size_t) written;
+		}
+#endif
+	}
+
+	std::filesystem::path m_path;
+
+#ifdef _WIN32
+	std::ofstream m_stream;
+#else
+	int m_file = -1;
+#endif
+
+	size_t m_offset = 0;
+	bool m_compressed;
+
+	size_t m_chunk_count = 0;
+	size_t m_chunk_table_offset = 0;
+	std::vector<uint32_t> m_chunk_sizes;
+
+	std::vector<uint32_t> m_swapped_words;
+};
+
+void voxelizer::write_octree_file(
+	std::filesystem::path const& path,
+	glm::uvec3 const& volume_size,
+	uint32_t resolution,
+	std::vector<GLuint> const& octree_data,
+	uint32_t version
+)
+{
+	octree_file_writer writer(path, volume_size, resolution, octree_data.size(), version);
+	writer.write_nodes(octree_data.data(), octree_data.size());
+	writer.finish();
+}
+
+void voxelizer::write_octree_file(
+	std::filesystem::path const& path,
+	glm::uvec3 const& volume_size,
+	uint32_t resolution,
+	voxelizer::octree const& octree,
+	uint32_t version
+)
+{
+	size_t bytesize = octree.get_used_bytesize();
+	size_t chunk_count = (bytesize + k_write_chunk_size - 1) / k_write_chunk_size;
+
+	octree_file_writer writer(path, volume_size, resolution, octree.m_node_count, version);
+	voxelizer::staging_ring staging_ring(k_write_chunk_size, k_write_chunk_count, GL_MAP_READ_BIT);
+
+	auto get_chunk_size = [&](size_t chunk_idx)
+	{
+		return std::min(k_write_chunk_size, bytesize - chunk_idx * k_write_chunk_size);
+	};
+
+	auto copy_chunk = [&](size_t chunk_idx, size_t staging_offset)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, octree.m_buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, staging_ring.m_name);
+
+		GLintptr offset = (GLintptr) (octree.m_offset + chunk_idx * k_write_chunk_size);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, (GLintptr) staging_offset, (GLsizeiptr) get_chunk_size(chunk_idx));
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	};
+
+	// Every slot gets a chunk in flight, then a chunk is written to disk while the following ones are being copied. The
+	// whole ring is cycled, so that the slot acquired next is the first one
+	size_t issued_count = 0;
+	for (uint32_t slot = 0; slot < k_write_chunk_count; slot++)
+	{
+		size_t staging_offset = staging_ring.acquire();
+
+		if (issued_count < chunk_count)
+			copy_chunk(issued_count++, staging_offset);
+
+		staging_ring.release();
+	}
+
+	for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+	{
+		size_t staging_offset = staging_ring.acquire(); // Waits for the chunk to be copied
+
+		writer.write_nodes((GLuint const*) (staging_ring.m_mapped + staging_offset), get_chunk_size(chunk_idx) / sizeof(GLuint));
+
+		if (issued_count < chunk_count)
+			copy_chunk(issued_count++, staging_offset);
+
+		staging_ring.release();
+	}
+
+	writer.finish();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reading
+// ------------------------------------------------------------------------------------------------
+
+std::vector<GLuint> voxelizer::read_octree_file(std::filesystem::path const& path, voxelizer::octree_file_header& header)
+{
+	voxelizer::mapped_octree_file file(path);
+	header = file.m_header;
+
+	std::vector<GLuint> result(file.m_node_count);
+	file.read_nodes(0, result.size(), result.data());
+
+	return result;
+}
+
+voxelizer::mapped_octree_file::mapped_octree_file(std::filesystem::path const& path) :
+	m_file(path)
+{
+	size_t const header_size = 6 * sizeof(uint32_t);
+	size_t const chunked_header_size = 8 * sizeof(uint32_t);
+
+	if (m_file.m_size < header_size)
+		throw std::runtime_error("Invalid or unsupported octree file: " + path.u8string());
+
+	m_header.m_version = read_u32(m_file.m_data);
+	m_header.m_volume_size.x = read_u32(m_file.m_data + 4);
+	m_header.m_volume_size.y = read_u32(m_file.m_data + 8);
+	m_header.m_volume_size.z = read_u32(m_file.m_data + 12);
+	m_header.m_resolution = read_u32(m_file.m_data + 16);
+
+	if (m_header.m_version == 0 || m_header.m_version > k_octree_file_version)
+		throw std::runtime_error("Invalid or unsupported octree file: " + path.u8string());
+
+	if (m_header.m_version < 3)
+	{
+		m_header.m_bytesize = read_u32(m_file.m_data + 20);
+		m_node_count = m_header.m_bytesize / sizeof(GLuint);
+	}
+	else
+	{
+		m_node_count = read_u32(m_file.m_data + 20);
+		m_header.m_bytesize = m_node_count * sizeof(GLuint);
+	}
+
+	// Version 1 and 2 only differ in how many nodes are stored, the layout is the same
+	if (m_header.m_version < 3)
+	{
+		m_data_offset = header_size;
+
+		if (m_file.m_size - m_data_offset < m_header.m_bytesize)
+			throw std::runtime_error("Truncated octree file: " + path.u8string());
+
+		return;
+	}
+
+	if (m_file.m_size < chunked_header_size)
+		throw std::runtime_error("Truncated octree file: " + path.u8string());
+
+	m_header.m_chunk_node_count = read_u32(m_file.m_data + 24);
+	m_header.m_chunk_count = read_u32(m_file.m_data + 28);
+
+	if (m_header.m_chunk_node_count == 0 || m_header.m_chunk_count != (m_node_count + m_header.m_chunk_node_count - 1) / m_header.m_chunk_node_count)
+		throw std::runtime_error("Invalid or unsupported octree file: " + path.u8string());
+
+	m_data_offset = chunked_header_size + m_header.m_chunk_count * sizeof(uint32_t);
+
+	if (m_file.m_size < m_data_offset)
+		throw std::runtime_error("Truncated octree file: " + path.u8string());
+
+	m_chunk_offsets.resize(m_header.m_chunk_count + 1);
+	m_chunk_offsets[0] = m_data_offset;
+
+	for (uint32_t i = 0; i < m_header.m_chunk_count; i++)
+		m_chunk_offsets[i + 1] = m_chunk_offsets[i] + read_u32(m_file.m_data + chunked_header_size + i * sizeof(uint32_t));
+
+	if (m_chunk_offsets.back() > m_file.m_size)
+		throw std::runtime_error("Truncated octree file: " + path.u8string());
+}
+
+void voxelizer::mapped_octree_file::read_nodes(size_t first_node, size_t count, GLuint* nodes, uint32_t thread_count) const
+{
+	if (first_node + count > m_node_count)
+		throw std::out_of_range("Octree nodes out of the file");
+
+	if (count == 0)
+		return;
+
+	if (m_header.m_version < 3)
+	{
+		uint8_t const* data = m_file.m_data + m_data_offset + first_node * sizeof(GLuint);
+
+		if (is_little_endian())
+		{
+			std::memcpy(nodes, data, count * sizeof(GLuint));
+		}
+		else
+		{
+			for (size_t i = 0; i < count; i++)
+				nodes[i] = read_u32(data + i * sizeof(GLuint));
+		}
+
+		return;
+	}
+
+	size_t chunk_node_count = m_header.m_chunk_node_count;
+	size_t first_chunk = first_node / chunk_node_count;
+	size_t chunk_count = (first_node + count - 1) / chunk_node_count + 1 - first_chunk;
+
+	voxelizer::parallel_for(chunk_count, thread_count, [&](size_t begin, size_t end, uint32_t)
+	{
+		std::vector<GLuint> partial_chunk;
+
+		for (size_t i = begin; i < end; i++)
+		{
+			size_t chunk_idx = first_chunk + i;
+			size_t chunk_begin = chunk_idx * chunk_node_count;
+			size_t chunk_end = std::min(chunk_begin + chunk_node_count, m_node_count);
+
+			uint8_t const* data = m_file.m_data + m_chunk_offsets[chunk_idx];
+			size_t size = (size_t) (m_chunk_offsets[chunk_idx + 1] - m_chunk_offsets[chunk_idx]);
+
+			// Chunks fully in the range are decompressed in place, the ones at the range ends are cropped
+			size_t copy_begin = std::max(chunk_begin, first_node);
+			size_t copy_end = std::min(chunk_end, first_node + count);
+
+			if (copy_begin == chunk_begin && copy_end == chunk_end)
+			{
+				decompress_chunk(data, size, nodes + (chunk_begin - first_node), chunk_end - chunk_begin);
+			}
+			else
+			{
+				partial_chunk.resize(chunk_end - chunk_begin);
+				decompress_chunk(data, size, partial_chunk.data(), partial_chunk.size());
+
+				std::copy(partial_chunk.begin() + (copy_begin - chunk_begin), partial_chunk.begin() + (copy_end - chunk_begin), nodes + (copy_begin - first_node));
+			}
+		}
+	});
+}
+
+GLuint voxelizer::mapped_octree_file::upload(size_t chunk_size) const
+{
+	size_t bytesize = m_node_count * sizeof(GLuint);
+
+	// Where the nodes of the range are stored in the file, to prefetch them
+	auto get_file_range = [&](size_t offset, size_t size) -> std::pair<size_t, size_t>
+	{
+		offset = std::min(offset, bytesize);
+		size = std::min(size, bytesize - offset);
+
+		if (m_header.m_version < 3)
+			return {m_data_offset + offset, size};
+
+		size_t chunk_bytesize = m_header.m_chunk_node_count * sizeof(GLuint);
+		size_t first_chunk = offset / chunk_bytesize;
+		size_t end_chunk = std::min((offset + size + chunk_bytesize - 1) / chunk_bytesize, (size_t) m_header.m_chunk_count);
+
+		return {(size_t) m_chunk_offsets[first_chunk], (size_t) (m_chunk_offsets[end_chunk] - m_chunk_offsets[first_chunk])};
+	};
+
+	auto prefetch = [&](size_t offset, size_t size)
+	{
+		auto [file_offset, file_size] = get_file_range(offset, size);
+		m_file.prefetch(file_offset, file_size);
+	};
+
+	GLuint buffer{};
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr) std::max(bytesize, sizeof(GLuint)), nullptr, NULL); // Empty storage isn't allowed
+
+	voxelizer::staging_ring staging_ring(chunk_size, k_upload_chunk_count);
+
+	prefetch(0, chunk_size);
+
+	for (size_t offset = 0; offset < bytesize; offset += chunk_size)
+	{
+		size_t size = std::min(chunk_size, bytesize - offset);
+
+		// The disk reads of the next chunk overlap the copies of this one
+		prefetch(offset + size, chunk_size);
+
+		// The nodes are decompressed straight into the staging memory
+		size_t staging_offset = staging_ring.acquire();
+		read_nodes(offset / sizeof(GLuint), size / sizeof(GLuint), (GLuint*) (staging_ring.m_mapped + staging_offset));
+
+		glBindBuffer(GL_COPY_READ_BUFFER, staging_ring.m_name);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) staging_offset, (GLintptr) offset, (GLsizeiptr) size);
+
+		staging_ring.release();
+	}
+
+	// Deleting the staging ring is deferred by GL until the copies sourcing it have completed
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	return buffer;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "mapped_file.hpp"
+#include "octree.hpp"
+
+namespace voxelizer
+{
+	// Version 1: the octree data is the dense, worst-case, buffer (octree::get_octree_bytesize).
+	// Version 2: the octree data is trimmed to the allocated nodes (octree::m_node_count).
+	// Version 3: the nodes are split in chunks deflated independently, listed in a chunk table after the header. Within a chunk
+	//            the bytes of the nodes are stored by significance (all the lowest bytes first), so the MSB plane holding the
+	//            parent flags and the planes of the colors/addresses are compressed as separate streams.
+	constexpr uint32_t k_octree_file_version = 3;
+	constexpr uint32_t k_octree_file_chunk_node_count = 1 << 18; // 1 MB chunks.
+
+	struct octree_file_header
+	{
+		uint32_t m_version;
+		glm::uvec3 m_volume_size;
+		uint32_t m_resolution;
+		uint64_t m_bytesize; // The bytesize of the octree data (uncompressed), version 3 files store the node count instead.
+		uint32_t m_chunk_node_count = 0; // Version 3 only.
+		uint32_t m_chunk_count = 0;      // Version 3 only.
+	};
+
+	/// Downloads the allocated nodes of the given octree from the GPU.
+	std::vector<GLuint> download_octree(voxelizer::octree const& octree);
+
+	/// @param version 3 compresses the nodes (in parallel), 2 writes them as they are.
+	void write_octree_file(
+		std::filesystem::path const& path,
+		glm::uvec3 const& volume_size,
+		uint32_t resolution,
+		std::vector<GLuint> const& octree_data,
+		uint32_t version = k_octree_file_version
+	);
+
+	/// Streams the allocated nodes of the octree from the GPU to the file, through a persistent-mapped read ring: the next
+	/// chunks are copied on the GPU while the previous one is written, no host copy of the whole octree is made.
+	void write_octree_file(
+		std::filesystem::path const& path,
+		glm::uvec3 const& volume_size,
+		uint32_t resolution,
+		voxelizer::octree const& octree,
+		uint32_t version = k_octree_file_version
+	);
+
+	/// Reads all the file versions.
+	std::vector<GLuint> read_octree_file(std::filesystem::path const& path, voxelizer::octree_file_header& header);
+
+	/// An octree file mapped in memory, the nodes are read in place rather than copied on the heap. Compressed files are
+	/// decompressed chunk by chunk (in parallel) and only for the ranges requested.
+	class mapped_octree_file
+	{
+	public:
+		voxelizer::octree_file_header m_header;
+		size_t m_node_count = 0;
+
+		/// Reads all the file versions.
+		explicit mapped_octree_file(std::filesystem::path const& path);
+		mapped_octree_file(mapped_octree_file const&) = delete;
+
+		/// Reads the nodes [first_node, first_node + count), only decompressing the chunks overlapping the range.
+		/// @param thread_count The threads decompressing the chunks, 0 means all the hardware threads.
+		void read_nodes(size_t first_node, size_t count, GLuint* nodes, uint32_t thread_count = 0) const;
+
+		/// Uploads the nodes to a new GPU buffer (immutable, m_node_count GLuint). The nodes are read (or decompressed)
+		/// straight into a persistent-mapped staging ring, chunk by chunk, and the next chunk is prefetched from disk while
+		/// the previous ones are copied.
+		GLuint upload(size_t chunk_size = k_upload_chunk_size) const;
+
+		static constexpr size_t k_upload_chunk_size = 16 << 20; // A multiple of the compressed chunks.
+		static constexpr uint32_t k_upload_chunk_count = 3;     // The chunks in flight.
+
+	private:
+		voxelizer::mapped_file m_file;
+		size_t m_data_offset = 0;            // Where the node data (or the first compressed chunk) starts.
+		std::vector<uint64_t> m_chunk_offsets; // Version 3, the bounds of the compressed chunks (chunk count + 1).
+	};
+}
@@ -0,0 +1,656 @@
+#include "octree_query.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "octree.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+
+// The deepest level a ray can reach, as svo_tracer.frag (the resolution is at most 21 anyway)
+constexpr uint32_t k_max_depth = 32;
+
+// The components of the ray directions are kept at least this far from 0, as svo_tracer.frag does
+constexpr float k_direction_epsilon = 3.552713678800501e-15f;
+
+// Fewer queries than these per thread aren't worth spawning the thread
+constexpr size_t k_min_queries_per_thread = 4096;
+
+uint32_t get_query_thread_count(uint32_t thread_count, size_t count)
+{
+	size_t max_thread_count = std::max<size_t>(count / k_min_queries_per_thread, 1);
+	return (uint32_t) std::min<size_t>(voxelizer::get_thread_count(thread_count), max_thread_count);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Point lookup
+// ------------------------------------------------------------------------------------------------
+
+GLuint lookup_scalar(GLuint const* octree, uint32_t resolution, glm::uvec3 position)
+{
+	if (((position.x | position.y | position.z) >> resolution) != 0)
+		return 0;
+
+	uint32_t address = 0;
+
+	for (uint32_t level = 1; level <= resolution; level++)
+	{
+		uint32_t shift = resolution - level;
+		uint32_t child = ((position.x >> shift) & 1) | (((position.y >> shift) & 1) << 1) | (((position.z >> shift) & 1) << 2);
+
+		GLuint value = octree[address + child];
+		if (voxelizer::octree::is_leaf(value))
+			return value;
+
+		address = voxelizer::octree::get_value(value);
+	}
+
+	return 0;
+}
+
+#if defined(VOXELIZER_X86)
+
+VOXELIZER_TARGET_AVX2 void lookup_avx2(GLuint const* octree, uint32_t resolution, glm::uvec3 const* positions, size_t count, GLuint* values)
+{
+	__m256i const zero = _mm256_setzero_si256();
+	__m256i const one = _mm256_set1_epi32(1);
+	__m256i const address_mask = _mm256_set1_epi32(0x7fffffff);
+	__m256i const position_offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21); // The positions are 3 words each.
+
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		int const* position_words = (int const*) (positions + i);
+
+		__m256i x = _mm256_i32gather_epi32(position_words, position_offsets, 4);
+		__m256i y = _mm256_i32gather_epi32(position_words + 1, position_offsets, 4);
+		__m256i z = _mm256_i32gather_epi32(position_words + 2, position_offsets, 4);
+
+		// The lanes out of the octree stay 0
+		__m256i active = _mm256_or_si256(_mm256_or_si256(x, y), z);
+		active = _mm256_cmpeq_epi32(_mm256_srl_epi32(active, _mm_cvtsi32_si128((int) resolution)), zero);
+
+		__m256i address = zero;
+		__m256i result = zero;
+
+		for (uint32_t level = 1; level <= resolution && !_mm256_testz_si256(active, active); level++)
+		{
+			__m128i shift = _mm_cvtsi32_si128((int) (resolution - level));
+
+			__m256i child = _mm256_and_si256(_mm256_srl_epi32(x, shift), one);
+			child = _mm256_or_si256(child, _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(y, shift), one), 1));
+			child = _mm256_or_si256(child, _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(z, shift), one), 2));
+
+			__m256i value = _mm256_mask_i32gather_epi32(zero, (int const*) octree, _mm256_add_epi32(address, child), active, 4);
+			__m256i is_address = _mm256_srai_epi32(value, 31);
+
+			result = _mm256_or_si256(result, _mm256_andnot_si256(is_address, _mm256_and_si256(active, value)));
+			active = _mm256_and_si256(active, is_address);
+			address = _mm256_and_si256(value, address_mask);
+		}
+
+		_mm256_storeu_si256((__m256i*) (values + i), result);
+	}
+
+	for (; i < count; i++)
+		values[i] = lookup_scalar(octree, resolution, positions[i]);
+}
+
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// Ray casting
+// ------------------------------------------------------------------------------------------------
+
+/// The traversal state of svo_tracer.frag, once the ray entered the root.
+struct ray_state
+{
+	glm::vec3 m_t_corner; // Where the ray exits the current node, per axis.
+	glm::vec3 m_t_step;   // How much t advances crossing a node of the current level, per axis.
+	float m_t_min;
+	uint32_t m_dir_mask;
+	uint32_t m_frontal_mask;
+};
+
+VOXELIZER_FORCE_INLINE bool init_ray_state(voxelizer::octree_ray const& ray, float side, ray_state& state)
+{
+	glm::vec3 origin = ray.m_origin;
+	glm::vec3 direction = ray.m_direction;
+
+	for (uint32_t axis = 0; axis < 3; axis++)
+	{
+		if (std::abs(direction[axis]) <= k_direction_epsilon)
+			direction[axis] = direction[axis] >= 0 ? k_direction_epsilon : -k_direction_epsilon;
+	}
+
+	// Multiplying by the reciprocal rather than dividing as the shader does, the hits can differ in the last bits of t
+	glm::vec3 inv_direction = 1.0f / direction;
+
+	glm::vec3 t_from = -origin * inv_direction;
+	glm::vec3 t_to = (glm::vec3(side) - origin) * inv_direction;
+
+	glm::vec3 t_near = glm::min(t_from, t_to);
+	glm::vec3 t_far = glm::max(t_from, t_to);
+
+	float t_min = glm::max(glm::max(t_near.x, t_near.y), t_near.z);
+	float t_max = glm::min(glm::min(t_far.x, t_far.y), t_far.z);
+
+	// Unlike the shader, the octree behind the origin is a miss
+	if (t_min > t_max || t_max < 0)
+		return false;
+
+	t_min = glm::max(t_min, 0.0f);
+
+	float step = side * 0.5f;
+	glm::vec3 center(step);
+	glm::vec3 t_center = (center - origin) * inv_direction;
+
+	state.m_dir_mask = 0;
+	state.m_frontal_mask = 0;
+
+	glm::vec3 corner = center;
+
+	for (uint32_t axis = 0; axis < 3; axis++)
+	{
+		if (direction[axis] > 0)
+			state.m_dir_mask |= 1 << axis;
+
+		if (t_center[axis] > t_min)
+			state.m_frontal_mask |= 1 << axis;
+		else
+			corner[axis] += direction[axis] > 0 ? step : -step;
+	}
+
+	state.m_t_corner = (corner - origin) * inv_direction;
+	state.m_t_step = step * glm::abs(inv_direction);
+	state.m_t_min = t_min;
+
+	return true;
+}
+
+bool raycast_scalar(GLuint const* octree, float side, voxelizer::octree_ray const& ray, voxelizer::octree_ray_hit& hit)
+{
+	hit = {};
+
+	ray_state state{};
+	if (!init_ray_state(ray, side, state))
+		return false;
+
+	struct stack_entry
+	{
+		uint32_t m_node_address;
+		uint32_t m_frontal_mask;
+		glm::vec3 m_t_corner;
+	} stack[k_max_depth];
+
+	int32_t depth = 0;
+	uint32_t node_address = 0;
+
+	glm::vec3 t_corner = state.m_t_corner;
+	glm::vec3 t_step = state.m_t_step;
+	float t_min = state.m_t_min;
+	uint32_t frontal_mask = state.m_frontal_mask;
+
+	while (true)
+	{
+		GLuint value = octree[node_address + (frontal_mask ^ state.m_dir_mask)];
+
+		if (voxelizer::octree::is_address(value))
+		{
+			// Push
+			stack[depth++] = {node_address, frontal_mask, t_corner};
+
+			node_address = voxelizer::octree::get_value(value);
+			t_step *= 0.5f;
+
+			glm::vec3 t_center = t_corner - t_step;
+			frontal_mask = 0;
+
+			for (uint32_t axis = 0; axis < 3; axis++)
+			{
+				if (t_center[axis] >= t_min)
+				{
+					frontal_mask |= 1 << axis;
+					t_corner[axis] = t_center[axis];
+				}
+			}
+
+			continue;
+		}
+
+		if (value != 0)
+		{
+			hit.m_t = t_min;
+			hit.m_value = value;
+
+			return true;
+		}
+
+		while (true)
+		{
+			// Advance
+			t_min = glm::min(glm::min(t_corner.x, t_corner.y), t_corner.z);
+
+			uint32_t step_mask = 0;
+
+			for (uint32_t axis = 0; axis < 3; axis++)
+			{
+				if (t_corner[axis] <= t_min)
+				{
+					step_mask |= 1 << axis;
+					t_corner[axis] += t_step[axis];
+				}
+			}
+
+			frontal_mask ^= step_mask;
+
+			if ((frontal_mask & step_mask) == 0)
+				break;
+
+			// Pop, the ray left the parent
+			if (--depth < 0)
+				return false;
+
+			node_address = stack[depth].m_node_address;
+			frontal_mask = stack[depth].m_frontal_mask;
+			t_corner = stack[depth].m_t_corner;
+			t_step *= 2.0f;
+		}
+	}
+}
+
+#if defined(VOXELIZER_X86)
+
+#if defined(__GNUC__) && !defined(__clang__)
+	// raycast_packet<avx2_lanes> is always inlined in an AVX2 function, the ABI of its standalone version doesn't matter
+	#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// The vector operations used by raycast_packet, masks are all ones (or zeros) per lane
+
+struct sse_lanes
+{
+	static constexpr uint32_t k_width = 4;
+
+	using f32 = __m128;
+	using u32 = __m128i;
+
+	static f32 set(float value) { return _mm_set1_ps(value); }
+	static u32 set(uint32_t value) { return _mm_set1_epi32((int) value); }
+
+	static f32 load(float const* data) { return _mm_load_ps(data); }
+	static u32 load(uint32_t const* data) { return _mm_load_si128((__m128i const*) data); }
+
+	static void store(float* data, f32 value) { _mm_store_ps(data, value); }
+	static void store(uint32_t* data, u32 value) { _mm_store_si128((__m128i*) data, value); }
+
+	static f32 add(f32 a, f32 b) { return _mm_add_ps(a, b); }
+	static f32 sub(f32 a, f32 b) { return _mm_sub_ps(a, b); }
+	static f32 mul(f32 a, f32 b) { return _mm_mul_ps(a, b); }
+	static f32 min(f32 a, f32 b) { return _mm_min_ps(a, b); }
+
+	static u32 less_equal(f32 a, f32 b) { return _mm_castps_si128(_mm_cmple_ps(a, b)); }
+	static u32 greater_equal(f32 a, f32 b) { return _mm_castps_si128(_mm_cmpge_ps(a, b)); }
+
+	static u32 add(u32 a, u32 b) { return _mm_add_epi32(a, b); }
+	static u32 sub(u32 a, u32 b) { return _mm_sub_epi32(a, b); }
+	static u32 bit_and(u32 a, u32 b) { return _mm_and_si128(a, b); }
+	static u32 bit_and_not(u32 a, u32 b) { return _mm_andnot_si128(b, a); } // a & ~b
+	static u32 bit_or(u32 a, u32 b) { return _mm_or_si128(a, b); }
+	static u32 bit_xor(u32 a, u32 b) { return _mm_xor_si128(a, b); }
+	static u32 equal(u32 a, u32 b) { return _mm_cmpeq_epi32(a, b); }
+	static u32 sign_mask(u32 a) { return _mm_srai_epi32(a, 31); } // All ones where the MSB is set.
+
+	static f32 select(u32 mask, f32 a, f32 b)
+	{
+		f32 float_mask = _mm_castsi128_ps(mask);
+		return _mm_or_ps(_mm_and_ps(float_mask, a), _mm_andnot_ps(float_mask, b));
+	}
+
+	static u32 select(u32 mask, u32 a, u32 b)
+	{
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	}
+
+	static uint32_t get_bits(u32 mask) { return (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(mask)); }
+
+	static u32 gather(GLuint const* data, u32 indices, u32 mask)
+	{
+		alignas(16) uint32_t lane_indices[k_width];
+		alignas(16) uint32_t result[k_width]{};
+
+		store(lane_indices, indices);
+
+		for (uint32_t bits = get_bits(mask); bits != 0; bits &= bits - 1)
+		{
+			uint32_t lane = voxelizer::simd::count_trailing_zeros(bits);
+			result[lane] = data[lane_indices[lane]];
+		}
+
+		return load(result);
+	}
+};
+
+struct avx2_lanes
+{
+	static constexpr uint32_t k_width = 8;
+
+	using f32 = __m256;
+	using u32 = __m256i;
+
+	VOXELIZER_TARGET_AVX2 static f32 set(float value) { return _mm256_set1_ps(value); }
+	VOXELIZER_TARGET_AVX2 static u32 set(uint32_t value) { return _mm256_set1_epi32((int) value); }
+
+	VOXELIZER_TARGET_AVX2 static f32 load(float const* data) { return _mm256_load_ps(data); }
+	VOXELIZER_TARGET_AVX2 static u32 load(uint32_t const* data) { return _mm256_load_si256((__m256i const*) data); }
+
+	VOXELIZER_TARGET_AVX2 static void store(float* data, f32 value) { _mm256_store_ps(data, value); }
+	VOXELIZER_TARGET_AVX2 static void store(uint32_t* data, u32 value) { _mm256_store_si256((__m256i*) data, value); }
+
+	VOXELIZER_TARGET_AVX2 static f32 add(f32 a, f32 b) { return _mm256_add_ps(a, b); }
+	VOXELIZER_TARGET_AVX2 static f32 sub(f32 a, f32 b) { return _mm256_sub_ps(a, b); }
+	VOXELIZER_TARGET_AVX2 static f32 mul(f32 a, f32 b) { return _mm256_mul_ps(a, b); }
+	VOXELIZER_TARGET_AVX2 static f32 min(f32 a, f32 b) { return _mm256_min_ps(a, b); }
+
+	VOXELIZER_TARGET_AVX2 static u32 less_equal(f32 a, f32 b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+	VOXELIZER_TARGET_AVX2 static u32 greater_equal(f32 a, f32 b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+
+	VOXELIZER_TARGET_AVX2 static u32 add(u32 a, u32 b) { return _mm256_add_epi32(a, b); }
+	VOXELIZER_TARGET_AVX2 static u32 sub(u32 a, u32 b) { return _mm256_sub_epi32(a, b); }
+	VOXELIZER_TARGET_AVX2 static u32 bit_and(u32 a, u32 b) { return _mm256_and_si256(a, b); }
+	VOXELIZER_TARGET_AVX2 static u32 bit_and_not(u32 a, u32 b) { return _mm256_andnot_si256(b, a); } // a & ~b
+	VOXELIZER_TARGET_AVX2 static u32 bit_or(u32 a, u32 b) { return _mm256_or_si256(a, b); }
+	VOXELIZER_TARGET_AVX2 static u32 bit_xor(u32 a, u32 b) { return _mm256_xor_si256(a, b); }
+	VOXELIZER_TARGET_AVX2 static u32 equal(u32 a, u32 b) { return _mm256_cmpeq_epi32(a, b); }
+	VOXELIZER_TARGET_AVX2 static u32 sign_mask(u32 a) { return _mm256_srai_epi32(a, 31); } // All ones where the MSB is set.
+
+	VOXELIZER_TARGET_AVX2 static f32 select(u32 mask, f32 a, f32 b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask)); }
+	VOXELIZER_TARGET_AVX2 static u32 select(u32 mask, u32 a, u32 b) { return _mm256_blendv_epi8(b, a, mask); }
+
+	VOXELIZER_TARGET_AVX2 static uint32_t get_bits(u32 mask) { return (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(mask)); }
+
+	VOXELIZER_TARGET_AVX2 static u32 gather(GLuint const* data, u32 indices, u32 mask)
+	{
+		return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (int const*) data, indices, mask, 4);
+	}
+};
+
+/// raycast_scalar on a packet of rays: every lane keeps its own traversal state (and stack) and the lanes step together.
+/// At each iteration the lanes about to read a node push or hit, the others advance (and pop) once.
+template<typename _lanes>
+VOXELIZER_FORCE_INLINE void raycast_packet(GLuint const* octree, float side, voxelizer::octree_ray const* rays, uint32_t ray_count, voxelizer::octree_ray_hit* hits)
+{
+	using f32 = typename _lanes::f32;
+	using u32 = typename _lanes::u32;
+
+	constexpr uint32_t k_width = _lanes::k_width;
+
+	// The rays are set up one by one, the lanes of the rays missing the octree start inactive
+	alignas(32) float lane_t_corner[3][k_width]{};
+	alignas(32) float lane_t_step[3][k_width]{};
+	alignas(32) float lane_t_min[k_width]{};
+	alignas(32) uint32_t lane_dir_mask[k_width]{};
+	alignas(32) uint32_t lane_frontal_mask[k_width]{};
+	alignas(32) uint32_t lane_active[k_width]{};
+
+	for (uint32_t lane = 0; lane < ray_count; lane++)
+	{
+		hits[lane] = {};
+
+		ray_state state{};
+		if (!init_ray_state(rays[lane], side, state))
+			continue;
+
+		for (uint32_t axis = 0; axis < 3; axis++)
+		{
+			lane_t_corner[axis][lane] = state.m_t_corner[axis];
+			lane_t_step[axis][lane] = state.m_t_step[axis];
+		}
+
+		lane_t_min[lane] = state.m_t_min;
+		lane_dir_mask[lane] = state.m_dir_mask;
+		lane_frontal_mask[lane] = state.m_frontal_mask;
+		lane_active[lane] = UINT32_MAX;
+	}
+
+	f32 t_corner_x = _lanes::load(lane_t_corner[0]);
+	f32 t_corner_y = _lanes::load(lane_t_corner[1]);
+	f32 t_corner_z = _lanes::load(lane_t_corner[2]);
+	f32 t_step_x = _lanes::load(lane_t_step[0]);
+	f32 t_step_y = _lanes::load(lane_t_step[1]);
+	f32 t_step_z = _lanes::load(lane_t_step[2]);
+	f32 t_min = _lanes::load(lane_t_min);
+
+	u32 const zero = _lanes::set(0u);
+	u32 const one = _lanes::set(1u);
+	u32 const x_bit = _lanes::set(1u), y_bit = _lanes::set(2u), z_bit = _lanes::set(4u);
+
+	u32 dir_mask = _lanes::load(lane_dir_mask);
+	u32 frontal_mask = _lanes::load(lane_frontal_mask);
+	u32 node_address = zero;
+	u32 depth = zero;
+
+	u32 active = _lanes::load(lane_active);
+	u32 fetching = active; // The lanes reading a node, the other active ones advance.
+
+	// The stacks, a row per depth and a column per lane. The lanes at the same depth (usually most of them) push or pop
+	// with a single masked update of the row
+	alignas(32) uint32_t stack_node_address[k_max_depth][k_width];
+	alignas(32) uint32_t stack_frontal_mask[k_max_depth][k_width];
+	alignas(32) float stack_t_corner[k_max_depth][3][k_width];
+
+	alignas(32) uint32_t lane_depth[k_width];
+	alignas(32) uint32_t lane_value[k_width];
+
+	while (_lanes::get_bits(active) != 0)
+	{
+		u32 advancing = _lanes::bit_and_not(active, fetching);
+
+		if (_lanes::get_bits(fetching) != 0)
+		{
+			u32 value = _lanes::gather(octree, _lanes::add(node_address, _lanes::bit_xor(frontal_mask, dir_mask)), fetching);
+
+			u32 is_address = _lanes::bit_and(fetching, _lanes::sign_mask(value));
+			u32 is_empty = _lanes::bit_and(fetching, _lanes::equal(value, zero));
+			u32 is_hit = _lanes::bit_and_not(_lanes::bit_and_not(fetching, is_address), is_empty);
+
+			if (uint32_t hit_bits = _lanes::get_bits(is_hit))
+			{
+				_lanes::store(lane_value, value);
+				_lanes::store(lane_t_min, t_min);
+
+				for (; hit_bits != 0; hit_bits &= hit_bits - 1)
+				{
+					uint32_t lane = voxelizer::simd::count_trailing_zeros(hit_bits);
+					hits[lane].m_t = lane_t_min[lane];
+					hits[lane].m_value = lane_value[lane];
+				}
+
+				active = _lanes::bit_and_not(active, is_hit);
+			}
+
+			if (uint32_t push_bits = _lanes::get_bits(is_address))
+			{
+				// Push
+				_lanes::store(lane_depth, depth);
+
+				for (u32 pushing = is_address; push_bits != 0; push_bits = _lanes::get_bits(pushing))
+				{
+					uint32_t row = lane_depth[voxelizer::simd::count_trailing_zeros(push_bits)];
+					u32 row_mask = _lanes::bit_and(pushing, _lanes::equal(depth, _lanes::set(row)));
+
+					_lanes::store(stack_node_address[row], _lanes::select(row_mask, node_address, _lanes::load(stack_node_address[row])));
+					_lanes::store(stack_frontal_mask[row], _lanes::select(row_mask, frontal_mask, _lanes::load(stack_frontal_mask[row])));
+					_lanes::store(stack_t_corner[row][0], _lanes::select(row_mask, t_corner_x, _lanes::load(stack_t_corner[row][0])));
+					_lanes::store(stack_t_corner[row][1], _lanes::select(row_mask, t_corner_y, _lanes::load(stack_t_corner[row][1])));
+					_lanes::store(stack_t_corner[row][2], _lanes::select(row_mask, t_corner_z, _lanes::load(stack_t_corner[row][2])));
+
+					pushing = _lanes::bit_and_not(pushing, row_mask);
+				}
+
+				depth = _lanes::add(depth, _lanes::bit_and(is_address, one));
+				node_address = _lanes::select(is_address, _lanes::bit_and(value, _lanes::set(0x7fffffffu)), node_address);
+
+				f32 const half = _lanes::set(0.5f);
+				t_step_x = _lanes::select(is_address, _lanes::mul(t_step_x, half), t_step_x);
+				t_step_y = _lanes::select(is_address, _lanes::mul(t_step_y, half), t_step_y);
+				t_step_z = _lanes::select(is_address, _lanes::mul(t_step_z, half), t_step_z);
+
+				f32 t_center_x = _lanes::sub(t_corner_x, t_step_x);
+				f32 t_center_y = _lanes::sub(t_corner_y, t_step_y);
+				f32 t_center_z = _lanes::sub(t_corner_z, t_step_z);
+
+				u32 frontal_x = _lanes::bit_and(is_address, _lanes::greater_equal(t_center_x, t_min));
+				u32 frontal_y = _lanes::bit_and(is_address, _lanes::greater_equal(t_center_y, t_min));
+				u32 frontal_z = _lanes::bit_and(is_address, _lanes::greater_equal(t_center_z, t_min));
+
+				t_corner_x = _lanes::select(frontal_x, t_center_x, t_corner_x);
+				t_corner_y = _lanes::select(frontal_y, t_center_y, t_corner_y);
+				t_corner_z = _lanes::select(frontal_z, t_center_z, t_corner_z);
+
+				u32 child_frontal_mask = _lanes::bit_or(
+					_lanes::bit_or(_lanes::bit_and(frontal_x, x_bit), _lanes::bit_and(frontal_y, y_bit)),
+					_lanes::bit_and(frontal_z, z_bit)
+				);
+				frontal_mask = _lanes::select(is_address, child_frontal_mask, frontal_mask);
+			}
+
+			fetching = is_address;
+			advancing = _lanes::bit_or(advancing, is_empty);
+		}
+
+		if (_lanes::get_bits(advancing) != 0)
+		{
+			// Advance
+			f32 t_exit = _lanes::min(_lanes::min(t_corner_x, t_corner_y), t_corner_z);
+			t_min = _lanes::select(advancing, t_exit, t_min);
+
+			u32 step_x = _lanes::bit_and(advancing, _lanes::less_equal(t_corner_x, t_exit));
+			u32 step_y = _lanes::bit_and(advancing, _lanes::less_equal(t_corner_y, t_exit));
+			u32 step_z = _lanes::bit_and(advancing, _lanes::less_equal(t_corner_z, t_exit));
+
+			t_corner_x = _lanes::select(step_x, _lanes::add(t_corner_x, t_step_x), t_corner_x);
+			t_corner_y = _lanes::select(step_y, _lanes::add(t_corner_y, t_step_y), t_corner_y);
+			t_corner_z = _lanes::select(step_z, _lanes::add(t_corner_z, t_step_z), t_corner_z);
+
+			u32 step_mask = _lanes::bit_or(
+				_lanes::bit_or(_lanes::bit_and(step_x, x_bit), _lanes::bit_and(step_y, y_bit)),
+				_lanes::bit_and(step_z, z_bit)
+			);
+			frontal_mask = _lanes::bit_xor(frontal_mask, step_mask);
+
+			// The lanes entering a sibling read it next, the ones leaving the parent pop it and advance again
+			u32 popping = _lanes::bit_and_not(advancing, _lanes::equal(_lanes::bit_and(frontal_mask, step_mask), zero));
+			fetching = _lanes::bit_or(fetching, _lanes::bit_and_not(advancing, popping));
+
+			if (_lanes::get_bits(popping) != 0)
+			{
+				// Pop, popping the root means the ray left the octree
+				depth = _lanes::sub(depth, _lanes::bit_and(popping, one));
+
+				u32 missed = _lanes::bit_and(popping, _lanes::sign_mask(depth));
+				active = _lanes::bit_and_not(active, missed);
+				popping = _lanes::bit_and_not(popping, missed);
+
+				_lanes::store(lane_depth, depth);
+
+				u32 restoring = popping;
+				for (uint32_t pop_bits = _lanes::get_bits(restoring); pop_bits != 0; pop_bits = _lanes::get_bits(restoring))
+				{
+					uint32_t row = lane_depth[voxelizer::simd::count_trailing_zeros(pop_bits)];
+					u32 row_mask = _lanes::bit_and(restoring, _lanes::equal(depth, _lanes::set(row)));
+
+					node_address = _lanes::select(row_mask, _lanes::load(stack_node_address[row]), node_address);
+					frontal_mask = _lanes::select(row_mask, _lanes::load(stack_frontal_mask[row]), frontal_mask);
+					t_corner_x = _lanes::select(row_mask, _lanes::load(stack_t_corner[row][0]), t_corner_x);
+					t_corner_y = _lanes::select(row_mask, _lanes::load(stack_t_corner[row][1]), t_corner_y);
+					t_corner_z = _lanes::select(row_mask, _lanes::load(stack_t_corner[row][2]), t_corner_z);
+
+					restoring = _lanes::bit_and_not(restoring, row_mask);
+				}
+
+				f32 const two = _lanes::set(2.0f);
+				t_step_x = _lanes::select(popping, _lanes::mul(t_step_x, two), t_step_x);
+				t_step_y = _lanes::select(popping, _lanes::mul(t_step_y, two), t_step_y);
+				t_step_z = _lanes::select(popping, _lanes::mul(t_step_z, two), t_step_z);
+			}
+		}
+	}
+}
+
+template<typename _lanes>
+VOXELIZER_FORCE_INLINE void raycast_packets(GLuint const* octree, float side, voxelizer::octree_ray const* rays, size_t ray_count, voxelizer::octree_ray_hit* hits)
+{
+	for (size_t first = 0; first < ray_count; first += _lanes::k_width)
+		raycast_packet<_lanes>(octree, side, rays + first, (uint32_t) std::min<size_t>(_lanes::k_width, ray_count - first), hits + first);
+}
+
+void raycast_packets_sse(GLuint const* octree, float side, voxelizer::octree_ray const* rays, size_t ray_count, voxelizer::octree_ray_hit* hits)
+{
+	raycast_packets<sse_lanes>(octree, side, rays, ray_count, hits);
+}
+
+VOXELIZER_TARGET_AVX2 void raycast_packets_avx2(GLuint const* octree, float side, voxelizer::octree_ray const* rays, size_t ray_count, voxelizer::octree_ray_hit* hits)
+{
+	raycast_packets<avx2_lanes>(octree, side, rays, ray_count, hits);
+}
+
+#endif
+
+// ------------------------------------------------------------------------------------------------
+// octree_query
+// ------------------------------------------------------------------------------------------------
+
+voxelizer::octree_query::octree_query(GLuint const* octree, uint32_t resolution) :
+	m_octree(octree),
+	m_resolution(resolution)
+{}
+
+GLuint voxelizer::octree_query::lookup(glm::uvec3 const& position) const
+{
+	return lookup_scalar(m_octree, m_resolution, position);
+}
+
+void voxelizer::octree_query::lookup(glm::uvec3 const* positions, size_t count, GLuint* values) const
+{
+	uint32_t thread_count = get_query_thread_count(m_thread_count, count);
+
+	voxelizer::parallel_for(count, thread_count, [&](size_t begin, size_t end, uint32_t)
+	{
+#if defined(VOXELIZER_X86)
+		if (m_use_avx2 && voxelizer::simd::has_avx2())
+		{
+			lookup_avx2(m_octree, m_resolution, positions + begin, end - begin, values + begin);
+			return;
+		}
+#endif
+
+		for (size_t i = begin; i < end; i++)
+			values[i] = lookup_scalar(m_octree, m_resolution, positions[i]);
+	});
+}
+
+bool voxelizer::octree_query::raycast(voxelizer::octree_ray const& ray, voxelizer::octree_ray_hit& hit) const
+{
+	return raycast_scalar(m_octree, (float) (1u << m_resolution), ray, hit);
+}
+
+void voxelizer::octree_query::raycast(voxelizer::octree_ray const* rays, size_t count, voxelizer::octree_ray_hit* hits) const
+{
+	float side = (float) (1u << m_resolution);
+	uint32_t thread_count = get_query_thread_count(m_thread_count, count);
+
+	voxelizer::parallel_for(count, thread_count, [&](size_t begin, size_t end, uint32_t)
+	{
+#if defined(VOXELIZER_X86)
+		if (m_use_avx2 && voxelizer::simd::has_avx2())
+			raycast_packets_avx2(m_octree, side, rays + begin, end - begin, hits + begin);
+		else
+			raycast_packets_sse(m_octree, side, rays + begin, end - begin, hits + begin);
+#else
+		for (size_t i = begin; i < end; i++)
+			raycast_scalar(m_octree, side, rays[i], hits[i]);
+#endif
+	});
+}
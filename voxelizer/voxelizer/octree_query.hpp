@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+namespace voxelizer
+{
+	struct octree_ray
+	{
+		glm::vec3 m_origin;
+		glm::vec3 m_direction; // Doesn't need to be normalized.
+	};
+
+	struct octree_ray_hit
+	{
+		float m_t = 0;      // Where the ray enters the leaf hit, along the direction.
+		GLuint m_value = 0; // The leaf hit (RGBA8 color), 0 if nothing was hit.
+	};
+
+	/**
+	 * CPU queries on the nodes of an octree (as built, downloaded or read from a file, DAGs included), without any GL
+	 * context. Positions and rays are in voxel space: the octree spans [0, 2^resolution) on every axis.
+	 *
+	 * Rays are traced with the algorithm of svo_tracer.frag. The batched queries are split among the threads, rays are
+	 * traced in packets of 8 with AVX2 when the CPU supports it, of 4 with SSE otherwise, and points are looked up 8 at
+	 * a time with AVX2 gathers.
+	 */
+	class octree_query
+	{
+	public:
+		uint32_t m_thread_count = 0; // 0 means all the hardware threads.
+		bool m_use_avx2 = true;      // If false the batched queries take the SSE (or scalar) paths even if the CPU has AVX2.
+
+		/// The nodes aren't copied, they must outlive the query.
+		octree_query(GLuint const* octree, uint32_t resolution);
+
+		/// Returns the leaf containing the voxel (its RGBA8 color), 0 if it's empty or out of the octree.
+		GLuint lookup(glm::uvec3 const& position) const;
+		void lookup(glm::uvec3 const* positions, size_t count, GLuint* values) const;
+
+		/// Returns whether the ray hits a leaf, the nearest one is written to `hit` (also on miss, with a 0 value).
+		bool raycast(voxelizer::octree_ray const& ray, voxelizer::octree_ray_hit& hit) const;
+		void raycast(voxelizer::octree_ray const* rays, size_t count, voxelizer::octree_ray_hit* hits) const;
+
+	private:
+		GLuint const* m_octree;
+		uint32_t m_resolution;
+	};
+}
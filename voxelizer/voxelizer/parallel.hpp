@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace voxelizer
+{
+	/**
+	 * @param thread_count The requested number of threads, 0 stands for all the hardware threads.
+	 */
+	inline uint32_t get_thread_count(uint32_t thread_count = 0)
+	{
+		if (thread_count == 0)
+			thread_count = std::thread::hardware_concurrency();
+		return std::max<uint32_t>(thread_count, 1);
+	}
+
+	/**
+	 * Splits [0, count) in contiguous ranges, one per thread, and calls `f(begin, end, thread_idx)` for each of them.
+	 * The ranges are ordered by thread_idx, so results gathered per-thread can be concatenated deterministically.
+	 */
+	template<typename _func>
+	void parallel_for(size_t count, uint32_t thread_count, _func const& f)
+	{
+		thread_count = (uint32_t) std::min<size_t>(get_thread_count(thread_count), std::max<size_t>(count, 1));
+
+		size_t chunk = (count + thread_count - 1) / thread_count;
+
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
+
+		for (uint32_t thread_idx = 1; thread_idx < thread_count; thread_idx++)
+		{
+			size_t begin = std::min(thread_idx * chunk, count);
+			size_t end = std::min(begin + chunk, count);
+			threads.emplace_back([&f, begin, end, thread_idx] { f(begin, end, thread_idx); });
+		}
+
+		f(0, std::min(chunk, count), 0); // The calling thread takes the first range
+
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	/**
+	 * Sorts [first, last) with one std::sort per thread range, then merges the ranges pairwise (in parallel too).
+	 * Like std::sort it isn't stable.
+	 */
+	template<typename _iterator, typename _compare>
+	void parallel_sort(_iterator first, _iterator last, uint32_t thread_count, _compare const& compare)
+	{
+		size_t count = (size_t) (last - first);
+
+		std::vector<std::pair<size_t, size_t>> ranges(get_thread_count(thread_count), {0, 0});
+
+		parallel_for(count, thread_count, [&](size_t begin, size_t end, uint32_t thread_idx)
+		{
+			std::sort(first + begin, first + end, compare);
+			ranges[thread_idx] = {begin, end};
+		});
+
+		ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](auto const& range) { return range.first == range.second; }), ranges.end());
+
+		while (ranges.size() > 1)
+		{
+			std::vector<std::pair<size_t, size_t>> merged((ranges.size() + 1) / 2);
+
+			parallel_for(merged.size(), (uint32_t) merged.size(), [&](size_t begin, size_t end, uint32_t)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					if (2 * i + 1 == ranges.size())
+					{
+						merged[i] = ranges[2 * i];
+						continue;
+					}
+
+					auto const& left = ranges[2 * i];
+					auto const& right = ranges[2 * i + 1];
+
+					std::inplace_merge(first + left.first, first + right.first, first + right.second, compare);
+					merged[i] = {left.first, right.second};
+				}
+			});
+
+			ranges = std::move(merged);
+		}
+	}
+}
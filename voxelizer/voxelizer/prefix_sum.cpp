@@ -0,0 +1,134 @@
+#include "prefix_sum.hpp"
+
+#include <shinji.hpp>
+
+voxelizer::prefix_sum::prefix_sum()
+{
+	// scan
+	{
+		shader shader(GL_COMPUTE_SHADER);
+		shader.source_from_string(shinji::load_resource_from_bundle("resources/shaders/prefix_sum_scan.comp").m_data);
+		shader.compile();
+
+		m_scan.attach_shader(shader);
+		m_scan.link();
+	}
+
+	// add
+	{
+		shader shader(GL_COMPUTE_SHADER);
+		shader.source_from_string(shinji::load_resource_from_bundle("resources/shaders/prefix_sum_add.comp").m_data);
+		shader.compile();
+
+		m_add.attach_shader(shader);
+		m_add.link();
+	}
+
+	glGenBuffers(1, &m_total);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_total);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, NULL);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+voxelizer::prefix_sum::~prefix_sum()
+{
+	glDeleteBuffers(1, &m_total);
+	glDeleteBuffers((GLsizei) m_block_sums.size(), m_block_sums.data());
+}
+
+GLuint voxelizer::prefix_sum::reserve_block_sums(uint32_t level, size_t block_count)
+{
+	if (level >= m_block_sums.size())
+	{
+		GLuint block_sums{};
+		glGenBuffers(1, &block_sums);
+
+		m_block_sums.push_back(block_sums);
+		m_block_sums_capacity.push_back(0);
+	}
+
+	GLuint block_sums = m_block_sums[level];
+
+	if (block_count > m_block_sums_capacity[level])
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, block_sums);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (block_count * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		m_block_sums_capacity[level] = block_count;
+	}
+
+	return block_sums;
+}
+
+GLuint voxelizer::prefix_sum::operator()(GLuint buffer, size_t count, bool read_total)
+{
+	if (count == 0)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_total);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return 0;
+	}
+
+	scan(buffer, count, 0);
+
+	GLuint total = 0;
+
+	if (read_total)
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_total);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &total);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	return total;
+}
+
+void voxelizer::prefix_sum::scan(GLuint buffer, size_t count, uint32_t level)
+{
+	size_t block_count = (count + k_block_size - 1) / k_block_size;
+
+	GLuint block_sums = reserve_block_sums(level, block_count);
+
+	// Scans every block on its own, their sums are stored for the next level
+	m_scan.use();
+
+	glUniform1ui(m_scan.get_uniform_location("u_count"), (GLuint) count);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, block_sums);
+
+	dispatch_compute_1d(count, k_block_size);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if (block_count == 1)
+	{
+		// The sum of the only block is the total, copied on the GPU
+		glBindBuffer(GL_COPY_READ_BUFFER, block_sums);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_total);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	else
+	{
+		// The block sums are scanned (recursively) to get where every block starts
+		scan(block_sums, block_count, level + 1);
+
+		m_add.use();
+
+		glUniform1ui(m_add.get_uniform_location("u_count"), (GLuint) count);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, block_sums);
+
+		dispatch_compute_1d(count, k_block_size);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	program::unuse();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "gl.hpp"
+
+namespace voxelizer
+{
+	/// Exclusive prefix sum of GLuint values stored in a GL buffer, computed on the GPU in blocks of 512 values.
+	class prefix_sum
+	{
+	private:
+		program m_scan;
+		program m_add;
+
+		GLuint m_total = 0;
+
+		// The block sums of every recursion level, kept across the calls and grown as needed
+		std::vector<GLuint> m_block_sums;
+		std::vector<size_t> m_block_sums_capacity;
+
+		GLuint reserve_block_sums(uint32_t level, size_t block_count);
+		void scan(GLuint buffer, size_t count, uint32_t level);
+
+	public:
+		static constexpr size_t k_block_size = 512;
+
+		prefix_sum();
+		prefix_sum(prefix_sum const&) = delete;
+		~prefix_sum();
+
+		/// Replaces the first count values of the buffer with their exclusive prefix sum. The sum of all of them is left on the
+		/// GPU (get_total_buffer) for the next dispatches, it's read back (waiting for the scan) and returned only if read_total
+		/// is set.
+		GLuint operator()(GLuint buffer, size_t count, bool read_total = false);
+
+		/// A buffer of one GLuint, holding the sum of the last scan.
+		GLuint get_total_buffer() const { return m_total; }
+	};
+}
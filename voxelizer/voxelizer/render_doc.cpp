@@ -4,16 +4,33 @@
 #include <iostream>
 
 #include <renderdoc_app.h>
-#define NOMINMAX
-#include <windows.h>
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <dlfcn.h>
+#endif
 
 RENDERDOC_API_1_1_2* g_handle = nullptr;
 
-void renderdoc_init()
+pRENDERDOC_GetAPI get_renderdoc_get_api()
 {
+	// Only attaches to RenderDoc if it has already injected itself in the process
+#ifdef _WIN32
 	if (HMODULE module = GetModuleHandleA("renderdoc.dll"))
+		return (pRENDERDOC_GetAPI) GetProcAddress(module, "RENDERDOC_GetAPI");
+#else
+	if (void* module = dlopen("librenderdoc.so", RTLD_NOW | RTLD_NOLOAD))
+		return (pRENDERDOC_GetAPI) dlsym(module, "RENDERDOC_GetAPI");
+#endif
+	return nullptr;
+}
+
+void renderdoc_init()
+{
+	if (auto RENDERDOC_GetAPI = get_renderdoc_get_api())
 	{
-		auto RENDERDOC_GetAPI = (pRENDERDOC_GetAPI) GetProcAddress(module, "RENDERDOC_GetAPI");
 		int result = RENDERDOC_GetAPI(eRENDERDOC_API_Version_1_1_2, (void**) &g_handle);
 		if (result != 1)
 		{
@@ -4,25 +4,41 @@
 // material
 // ------------------------------------------------------------------------------------------------
 
-voxelizer::material::material()
+voxelizer::material::texture::texture(bool create_gl_object)
 {
-	glGenTextures(material::type::Count, m_textures);
+	if (create_gl_object)
+		glGenTextures(1, &m_name);
 }
 
-voxelizer::material::~material()
+voxelizer::material::texture::~texture()
 {
-	glDeleteTextures(material::type::Count, m_textures);
+	if (m_name != NULL)
+		glDeleteTextures(1, &m_name);
+}
+
+voxelizer::material::material(bool create_gl_objects) :
+	m_colors{},
+	m_textures{}
+{
+	if (create_gl_objects)
+	{
+		for (std::shared_ptr<texture>& texture : m_textures)
+			texture = std::make_shared<material::texture>(true);
+	}
 }
 
 // ------------------------------------------------------------------------------------------------
 // mesh
 // ------------------------------------------------------------------------------------------------
 
-voxelizer::mesh::mesh()
+voxelizer::mesh::mesh(bool create_gl_objects)
 {
-	glGenVertexArrays(1, &m_vao);
-	glGenBuffers(mesh::attribute::Count, m_vbos.data());
-	glGenBuffers(1, &m_ebo);
+	if (create_gl_objects)
+	{
+		glGenVertexArrays(1, &m_vao);
+		glGenBuffers(mesh::attribute::Count, m_vbos.data());
+		glGenBuffers(1, &m_ebo);
+	}
 }
 
 voxelizer::mesh::mesh(voxelizer::mesh&& other) noexcept :
@@ -31,22 +47,33 @@ voxelizer::mesh::mesh(voxelizer::mesh&& other) noexcept :
 	m_vao(other.m_vao),
 	m_vbos(other.m_vbos),
 	m_ebo(other.m_ebo),
+	m_index_type(other.m_index_type),
+	m_index_offset(other.m_index_offset),
+	m_borrowed_ebo(other.m_borrowed_ebo),
 	m_triangle_count(other.m_triangle_count),
 	m_element_count(other.m_element_count),
+	m_vertex_count(other.m_vertex_count),
 	m_transform(other.m_transform),
 	m_material(other.m_material),
 	m_transformed_min(other.m_transformed_min),
-	m_transformed_max(other.m_transformed_max)
+	m_transformed_max(other.m_transformed_max),
+	m_positions(std::move(other.m_positions)),
+	m_normals(std::move(other.m_normals)),
+	m_uvs(std::move(other.m_uvs)),
+	m_colors(std::move(other.m_colors)),
+	m_indices(std::move(other.m_indices))
 {
 	other.m_valid = false;
 }
 
 voxelizer::mesh::~mesh()
 {
-	if (m_valid)
+	if (m_valid && m_vao != NULL)
 	{
 		glDeleteVertexArrays(1, &m_vao);
 		glDeleteBuffers(mesh::attribute::Count, m_vbos.data());
-		glDeleteBuffers(1, &m_ebo);
+
+		if (!m_borrowed_ebo)
+			glDeleteBuffers(1, &m_ebo);
 	}
 }
@@ -28,26 +28,64 @@ namespace voxelizer
 			Count
 		};
 
+		struct image
+		{
+			int m_width = 0, m_height = 0;
+			std::vector<uint8_t> m_data; // RGBA8, rows stored as in the source file.
+		};
+
+		/// A texture, it may be shared by several materials (e.g. the loader caches them by source file).
+		struct texture
+		{
+			GLuint m_name = NULL; // Only created for the GPU backend.
+			image m_image;        // Only filled if the scene is loaded for the CPU backend.
+
+			explicit texture(bool create_gl_object);
+			texture(texture const&) = delete;
+
+			~texture();
+		};
+
 	private:
 		glm::vec4 m_colors[material::type::Count];
-		GLuint m_textures[material::type::Count];
+		std::shared_ptr<texture> m_textures[material::type::Count];
 
 	public:
-		material();
+		/// If create_gl_objects is set, every slot gets its own (empty) texture, otherwise they're left to be set.
+		explicit material(bool create_gl_objects = true);
 		material(const material&) = delete;
 		material(const material&&) = delete;
 
-		~material();
-
 		glm::vec4& get_color(material::type type)
 		{
 			return m_colors[type];
 		}
 
+		glm::vec4 const& get_color(material::type type) const
+		{
+			return m_colors[type];
+		}
+
 		GLuint get_texture(material::type type) const
+		{
+			return m_textures[type] ? m_textures[type]->m_name : NULL;
+		}
+
+		std::shared_ptr<texture> const& get_shared_texture(material::type type) const
 		{
 			return m_textures[type];
 		}
+
+		void set_texture(material::type type, std::shared_ptr<texture> texture)
+		{
+			m_textures[type] = std::move(texture);
+		}
+
+		image const& get_image(material::type type) const
+		{
+			static image const empty_image{};
+			return m_textures[type] ? m_textures[type]->m_image : empty_image;
+		}
 	};
 
 	// ------------------------------------------------------------------------------------------------
@@ -68,12 +106,17 @@ namespace voxelizer
 
 		bool m_valid = true;
 
-		GLuint m_vao;
-		std::array<GLuint, mesh::attribute::Count> m_vbos;
-		GLuint m_ebo;
+		GLuint m_vao = NULL;
+		std::array<GLuint, mesh::attribute::Count> m_vbos{}; // The buffers owned by the mesh, NULL if the attribute is sourced elsewhere.
+		GLuint m_ebo = NULL;
+
+		GLenum m_index_type = GL_UNSIGNED_INT; // Or GL_UNSIGNED_SHORT.
+		size_t m_index_offset = 0;             // Byte offset of the first index within m_ebo.
+		bool m_borrowed_ebo = false;           // m_ebo belongs to the caller (see scene_builder) and isn't deleted with the mesh.
 
 		size_t m_triangle_count;
 		size_t m_element_count;
+		size_t m_vertex_count = 0; // 0 if unknown, then it's derived from the indices.
 
 		glm::mat4 m_transform;
 
@@ -81,7 +124,15 @@ namespace voxelizer
 
 		glm::vec3 m_transformed_min, m_transformed_max;
 
-		mesh();
+		// Host-side copy of the geometry, only filled if the scene is loaded for the CPU backend.
+		// Missing attributes are left empty.
+		std::vector<glm::vec3> m_positions;
+		std::vector<glm::vec3> m_normals;
+		std::vector<glm::vec2> m_uvs;
+		std::vector<glm::vec4> m_colors;
+		std::vector<GLuint> m_indices;
+
+		explicit mesh(bool create_gl_objects = true);
 		mesh(mesh const&) = delete;
 		mesh(mesh&& other) noexcept;
 
@@ -92,11 +143,15 @@ namespace voxelizer
 	// scene
 	// ------------------------------------------------------------------------------------------------
 
+	struct scene_batch;
+
 	struct scene
 	{
 		glm::vec3 m_transformed_min, m_transformed_max;
 		std::vector<mesh> m_meshes;
 
+		std::shared_ptr<scene_batch> m_batch; // If set, the meshes are voxelized through it (see scene_batch).
+
 		inline glm::vec3 get_transformed_size() const
 		{
 			return m_transformed_max - m_transformed_min;
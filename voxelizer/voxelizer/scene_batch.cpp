@@ -0,0 +1,387 @@
+#include "scene_batch.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include "scene.hpp"
+
+void allocate_buffer(GLuint buffer, size_t size)
+{
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/// Reads back, as floats, the given attribute of the vertices of the VAO (that must be bound). Disabled attributes take
+/// their current (generic) value, attributes with a divisor (constant for the loaders) take their first element.
+std::vector<float> read_vertex_attribute(GLuint index, GLint component_count, size_t vertex_count)
+{
+	std::vector<float> result(vertex_count * component_count);
+
+	GLint enabled{};
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
+
+	if (!enabled)
+	{
+		GLfloat value[4]{};
+		glGetVertexAttribfv(index, GL_CURRENT_VERTEX_ATTRIB, value);
+
+		for (size_t i = 0; i < vertex_count; i++)
+			std::memcpy(&result[i * component_count], value, component_count * sizeof(float));
+
+		return result;
+	}
+
+	GLint buffer{}, size{}, type{}, stride{}, divisor{};
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &buffer);
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_SIZE, &size);
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_TYPE, &type);
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &stride);
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_DIVISOR, &divisor);
+
+	void* pointer{};
+	glGetVertexAttribPointerv(index, GL_VERTEX_ATTRIB_ARRAY_POINTER, &pointer);
+
+	if (type != GL_FLOAT)
+		throw std::invalid_argument("Only float vertex attributes can be batched");
+
+	if (stride == 0)
+		stride = size * sizeof(float);
+
+	size_t element_count = divisor != 0 ? 1 : vertex_count;
+	GLintptr offset = (GLintptr) pointer;
+
+	std::vector<uint8_t> data((element_count - 1) * stride + size * sizeof(float));
+
+	glBindBuffer(GL_ARRAY_BUFFER, (GLuint) buffer);
+	glGetBufferSubData(GL_ARRAY_BUFFER, offset, (GLsizeiptr) data.size(), data.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The components that the attribute doesn't have take the default value (0, 0, 0, 1)
+	float const defaults[4]{0.0f, 0.0f, 0.0f, 1.0f};
+
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		float const* element = (float const*) &data[(divisor != 0 ? 0 : i) * stride];
+		for (GLint c = 0; c < component_count; c++)
+			result[i * component_count + c] = c < size ? element[c] : defaults[c];
+	}
+
+	return result;
+}
+
+/// Copies the given attribute of the vertices of the VAO (that must be bound) to the buffer, as tightly packed floats. Float
+/// attributes with that layout are copied on the GPU, those with a divisor (constant for the loaders) by repeating their
+/// first element; the others are read back and converted.
+void copy_vertex_attribute(GLuint index, GLint component_count, size_t vertex_count, GLuint buffer, size_t offset)
+{
+	if (vertex_count == 0)
+		return;
+
+	size_t element_size = component_count * sizeof(float);
+
+	GLint enabled{};
+	glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
+
+	if (enabled)
+	{
+		GLint source{}, size{}, type{}, stride{}, divisor{};
+		glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &source);
+		glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_SIZE, &size);
+		glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_TYPE, &type);
+		glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &stride);
+		glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_DIVISOR, &divisor);
+
+		void* pointer{};
+		glGetVertexAttribPointerv(index, GL_VERTEX_ATTRIB_ARRAY_POINTER, &pointer);
+
+		bool packed = divisor != 0 ? size >= component_count : size == component_count && (stride == 0 || (size_t) stride == element_size);
+
+		if (type == GL_FLOAT && packed)
+		{
+			size_t copied = divisor != 0 ? 1 : vertex_count;
+
+			glBindBuffer(GL_COPY_READ_BUFFER, (GLuint) source);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) pointer, (GLintptr) offset, (GLsizeiptr) (copied * element_size));
+
+			// The constant element fills the range by doubling copies
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+
+			for (; copied < vertex_count; copied *= 2)
+			{
+				size_t count = std::min(copied, vertex_count - copied);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) offset, (GLintptr) (offset + copied * element_size), (GLsizeiptr) (count * element_size));
+			}
+
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			return;
+		}
+	}
+
+	std::vector<float> data = read_vertex_attribute(index, component_count, vertex_count);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) offset, (GLsizeiptr) (data.size() * sizeof(float)), data.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/// The attribute from the host-side copy of the mesh if it has it, from its GL buffers otherwise.
+template<typename _vec>
+void copy_mesh_attribute(voxelizer::mesh const& mesh, voxelizer::mesh::attribute attribute, std::vector<_vec> const& host_data, size_t vertex_count, GLuint buffer, size_t base_vertex)
+{
+	size_t offset = base_vertex * sizeof(_vec);
+
+	if (host_data.size() >= vertex_count)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) offset, (GLsizeiptr) (vertex_count * sizeof(_vec)), host_data.data());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return;
+	}
+
+	glBindVertexArray(mesh.m_vao);
+	copy_vertex_attribute(attribute, _vec::length(), vertex_count, buffer, offset);
+	glBindVertexArray(0);
+}
+
+/// Reads the indices of the mesh on the host, from its host-side copy if it has it.
+std::vector<GLuint> read_indices(voxelizer::mesh const& mesh)
+{
+	if (mesh.m_indices.size() == mesh.m_element_count)
+		return mesh.m_indices;
+
+	std::vector<GLuint> indices(mesh.m_element_count);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, mesh.m_ebo);
+
+	if (mesh.m_index_type == GL_UNSIGNED_SHORT)
+	{
+		std::vector<GLushort> short_indices(mesh.m_element_count);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr) mesh.m_index_offset, (GLsizeiptr) (mesh.m_element_count * sizeof(GLushort)), short_indices.data());
+		std::copy(short_indices.begin(), short_indices.end(), indices.begin());
+	}
+	else
+	{
+		glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr) mesh.m_index_offset, (GLsizeiptr) (mesh.m_element_count * sizeof(GLuint)), indices.data());
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	return indices;
+}
+
+voxelizer::scene_batch::scene_batch(voxelizer::scene const& scene)
+{
+	struct batched_mesh
+	{
+		voxelizer::mesh const* m_mesh;
+		size_t m_first_index;
+		size_t m_base_vertex;
+		size_t m_vertex_count;
+	};
+
+	std::vector<batched_mesh> batched_meshes;
+	std::vector<draw> draws;
+	std::vector<GLuint> textures;
+
+	size_t index_count = 0;
+	size_t vertex_count = 0;
+
+	glGenTextures(1, &m_white_texture);
+	glBindTexture(GL_TEXTURE_2D, m_white_texture);
+	GLfloat white[4]{1.0f, 1.0f, 1.0f, 1.0f};
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_FLOAT, white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	// Layout, the geometry is copied once the buffers are allocated
+	for (uint32_t mesh_idx = 0; mesh_idx < scene.m_meshes.size(); mesh_idx++)
+	{
+		voxelizer::mesh const& mesh = scene.m_meshes[mesh_idx];
+
+		if (mesh.m_vao == NULL)
+			throw std::invalid_argument("The meshes of a batch must be uploaded to the GPU");
+
+		if (mesh.m_element_count == 0)
+			continue;
+
+		size_t mesh_vertex_count = mesh.m_vertex_count;
+		if (mesh_vertex_count == 0)
+		{
+			std::vector<GLuint> indices = read_indices(mesh);
+			mesh_vertex_count = (size_t) *std::max_element(indices.begin(), indices.end()) + 1;
+		}
+
+		batched_meshes.push_back(batched_mesh{&mesh, index_count, vertex_count, mesh_vertex_count});
+
+		draw_command command{};
+		command.m_count = (GLuint) mesh.m_element_count;
+		command.m_instance_count = 1;
+		command.m_first_index = (GLuint) index_count;
+		command.m_base_vertex = (GLint) vertex_count;
+		m_commands.push_back(command);
+
+		m_mesh_indices.push_back(mesh_idx);
+
+		index_count += mesh.m_element_count;
+		vertex_count += mesh_vertex_count;
+
+		// Draw, single texel textures (e.g. the placeholder of the materials without one) are folded into the color
+		draw draw{};
+		draw.m_transform = mesh.m_transform;
+		draw.m_color = mesh.m_material->get_color(voxelizer::material::type::DIFFUSE);
+
+		GLuint texture = mesh.m_material->get_texture(voxelizer::material::type::DIFFUSE);
+
+		GLint width{}, height{};
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+		if (width <= 1 && height <= 1)
+		{
+			GLfloat texel[4]{0.0f, 0.0f, 0.0f, 1.0f}; // What an incomplete texture samples to
+			if (width == 1)
+				glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, texel);
+
+			draw.m_color *= glm::vec4(texel[0], texel[1], texel[2], texel[3]);
+			texture = m_white_texture;
+		}
+
+		draws.push_back(draw);
+		textures.push_back(texture);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Geometry, from the host-side copy of the meshes that have it, copied on the GPU otherwise
+	glGenBuffers(1, &m_position_buffer);
+	glGenBuffers(1, &m_uv_buffer);
+	glGenBuffers(1, &m_color_buffer);
+	glGenBuffers(1, &m_index_buffer);
+
+	allocate_buffer(m_position_buffer, vertex_count * sizeof(glm::vec3));
+	allocate_buffer(m_uv_buffer, vertex_count * sizeof(glm::vec2));
+	allocate_buffer(m_color_buffer, vertex_count * sizeof(glm::vec4));
+	allocate_buffer(m_index_buffer, index_count * sizeof(GLuint));
+
+	for (batched_mesh const& batched_mesh : batched_meshes)
+	{
+		voxelizer::mesh const& mesh = *batched_mesh.m_mesh;
+
+		copy_mesh_attribute(mesh, voxelizer::mesh::attribute::POSITION, mesh.m_positions, batched_mesh.m_vertex_count, m_position_buffer, batched_mesh.m_base_vertex);
+		copy_mesh_attribute(mesh, voxelizer::mesh::attribute::UV, mesh.m_uvs, batched_mesh.m_vertex_count, m_uv_buffer, batched_mesh.m_base_vertex);
+		copy_mesh_attribute(mesh, voxelizer::mesh::attribute::COLOR, mesh.m_colors, batched_mesh.m_vertex_count, m_color_buffer, batched_mesh.m_base_vertex);
+
+		GLintptr index_offset = (GLintptr) (batched_mesh.m_first_index * sizeof(GLuint));
+		GLsizeiptr index_size = (GLsizeiptr) (mesh.m_element_count * sizeof(GLuint));
+
+		if (mesh.m_indices.size() != mesh.m_element_count && mesh.m_index_type == GL_UNSIGNED_INT)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, mesh.m_ebo);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, m_index_buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) mesh.m_index_offset, index_offset, index_size);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		else
+		{
+			// 16-bit GPU indices are widened on the host
+			std::vector<GLuint> indices = read_indices(mesh);
+
+			glBindBuffer(GL_COPY_WRITE_BUFFER, m_index_buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_size, indices.data());
+		}
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// Sorts the draws by texture, every texture is then bound once
+	std::vector<size_t> order(draws.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return textures[a] < textures[b]; });
+
+	std::vector<draw> sorted_draws(draws.size());
+	std::vector<draw_command> sorted_commands(draws.size());
+	std::vector<uint32_t> sorted_mesh_indices(draws.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		sorted_draws[i] = draws[order[i]];
+		sorted_commands[i] = m_commands[order[i]];
+		sorted_commands[i].m_base_instance = (GLuint) i;
+		sorted_mesh_indices[i] = m_mesh_indices[order[i]];
+
+		GLuint texture = textures[order[i]];
+		if (m_texture_groups.empty() || m_texture_groups.back().m_texture != texture)
+			m_texture_groups.push_back(texture_group{texture, i, 0});
+		m_texture_groups.back().m_draw_count++;
+	}
+
+	m_commands = std::move(sorted_commands);
+	m_mesh_indices = std::move(sorted_mesh_indices);
+
+	std::vector<GLuint> draw_ids(draws.size());
+	std::iota(draw_ids.begin(), draw_ids.end(), 0);
+
+	// Upload
+	glGenVertexArrays(1, &m_vao);
+	glGenBuffers(1, &m_draw_buffer);
+	glGenBuffers(1, &m_draw_id_buffer);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_draw_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (sorted_draws.size() * sizeof(draw)), sorted_draws.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindVertexArray(m_vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_position_buffer);
+	glEnableVertexAttribArray(voxelizer::mesh::attribute::POSITION);
+	glVertexAttribPointer(voxelizer::mesh::attribute::POSITION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_uv_buffer);
+	glEnableVertexAttribArray(voxelizer::mesh::attribute::UV);
+	glVertexAttribPointer(voxelizer::mesh::attribute::UV, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_color_buffer);
+	glEnableVertexAttribArray(voxelizer::mesh::attribute::COLOR);
+	glVertexAttribPointer(voxelizer::mesh::attribute::COLOR, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_draw_id_buffer);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (draw_ids.size() * sizeof(GLuint)), draw_ids.data(), GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(k_draw_id_attribute);
+	glVertexAttribIPointer(k_draw_id_attribute, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glVertexAttribDivisor(k_draw_id_attribute, 1);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+
+	glBindVertexArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	printf("[scene_batch] Batched %zu meshes, vertices: %zu, indices: %zu, textures: %zu\n",
+		m_commands.size(),
+		vertex_count,
+		index_count,
+		m_texture_groups.size()
+	);
+}
+
+voxelizer::scene_batch::~scene_batch()
+{
+	glDeleteVertexArrays(1, &m_vao);
+	glDeleteBuffers(1, &m_position_buffer);
+	glDeleteBuffers(1, &m_uv_buffer);
+	glDeleteBuffers(1, &m_color_buffer);
+	glDeleteBuffers(1, &m_index_buffer);
+	glDeleteBuffers(1, &m_draw_buffer);
+	glDeleteBuffers(1, &m_draw_id_buffer);
+	glDeleteTextures(1, &m_white_texture);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+namespace voxelizer
+{
+	struct scene;
+
+	/// The meshes of a scene merged in shared vertex/index buffers, so that the whole scene can be drawn with a few
+	/// glMultiDrawElementsIndirect calls (one per texture). Every draw takes its transform and color from an SSBO, indexed
+	/// by the draw id (an instanced attribute, offset by the baseInstance of the draw command).
+	struct scene_batch
+	{
+		struct draw
+		{
+			glm::mat4 m_transform;
+			glm::vec4 m_color; // The diffuse color, multiplied by the texel if the texture was a single texel.
+		};
+
+		struct draw_command // Same layout as the command of glMultiDrawElementsIndirect.
+		{
+			GLuint m_count;
+			GLuint m_instance_count;
+			GLuint m_first_index;
+			GLint m_base_vertex;
+			GLuint m_base_instance; // The draw id.
+		};
+
+		struct texture_group // The draws of a group sample the same texture and are contiguous.
+		{
+			GLuint m_texture;
+			size_t m_first_draw;
+			size_t m_draw_count;
+		};
+
+		static constexpr GLuint k_draw_id_attribute = 4;
+
+		GLuint m_vao = 0;
+		GLuint m_position_buffer = 0; // glm::vec3
+		GLuint m_uv_buffer = 0;       // glm::vec2
+		GLuint m_color_buffer = 0;    // glm::vec4
+		GLuint m_index_buffer = 0;    // GLuint
+		GLuint m_draw_buffer = 0;     // scene_batch::draw (std430), an SSBO
+		GLuint m_draw_id_buffer = 0;  // GLuint, 0 to draw count
+		GLuint m_white_texture = 0;   // Sampled by the draws whose texture was a single texel.
+
+		std::vector<draw_command> m_commands; // Sorted by texture.
+		std::vector<uint32_t> m_mesh_indices; // The mesh every draw comes from.
+		std::vector<texture_group> m_texture_groups;
+
+		/// Merges the geometry of the meshes (that must have been uploaded to the GPU): from their host-side copy if they have
+		/// it, otherwise copying their buffers on the GPU (only strided attributes and 16-bit indices are read back, to be
+		/// converted). The batch doesn't follow later changes to the scene.
+		explicit scene_batch(voxelizer::scene const& scene);
+		scene_batch(scene_batch const&) = delete;
+		~scene_batch();
+	};
+}
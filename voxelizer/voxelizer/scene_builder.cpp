@@ -0,0 +1,335 @@
+#include "scene_builder.hpp"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+size_t get_element_stride(voxelizer::vertex_attribute_source const& source)
+{
+	return source.m_stride != 0 ? source.m_stride : source.m_component_count * sizeof(GLfloat);
+}
+
+/// The bytes spanned by the attribute, from its first element.
+size_t get_attribute_size(voxelizer::vertex_attribute_source const& source, size_t vertex_count)
+{
+	return vertex_count > 0 ? (vertex_count - 1) * get_element_stride(source) + source.m_component_count * sizeof(GLfloat) : 0;
+}
+
+/// Returns where the first element can be read on the host: the caller array, or a copy of the GL buffer range.
+uint8_t const* read_source(void const* data, GLuint buffer, size_t offset, size_t size, std::vector<uint8_t>& storage)
+{
+	if (data != nullptr)
+		return (uint8_t const*) data + offset;
+
+	storage.resize(size);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr) offset, (GLsizeiptr) size, storage.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	return storage.data();
+}
+
+template<typename _vec>
+void copy_host_attribute(std::vector<_vec>& result, voxelizer::vertex_attribute_source const& source, size_t vertex_count)
+{
+	if (!source.is_set())
+		return;
+
+	std::vector<uint8_t> storage;
+	uint8_t const* data = read_source(source.m_data, source.m_buffer, source.m_offset, get_attribute_size(source, vertex_count), storage);
+
+	size_t stride = get_element_stride(source);
+	float const defaults[4]{0.0f, 0.0f, 0.0f, 1.0f};
+
+	result.resize(vertex_count);
+
+	for (size_t i = 0; i < vertex_count; i++)
+	{
+		float element[4]{};
+		std::memcpy(element, data + i * stride, source.m_component_count * sizeof(float)); // Strided data may be unaligned
+
+		for (int c = 0; c < _vec::length(); c++)
+			result[i][c] = c < source.m_component_count ? element[c] : defaults[c];
+	}
+}
+
+void set_vertex_attribute(voxelizer::mesh::attribute attribute, GLuint buffer, voxelizer::vertex_attribute_source const& source)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	glEnableVertexAttribArray(attribute);
+	glVertexAttribPointer(attribute, source.m_component_count, GL_FLOAT, GL_FALSE, (GLsizei) source.m_stride, (void*) source.m_offset);
+}
+
+/// The attributes the mesh doesn't have take a constant value (as the assimp_scene_loader does).
+void set_constant_vertex_attribute(voxelizer::mesh& mesh, voxelizer::mesh::attribute attribute, glm::vec4 const& value, size_t vertex_count)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.m_vbos[attribute]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4), &value[0], GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(attribute);
+	glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(attribute, (GLuint) glm::max<size_t>(vertex_count, 1));
+}
+
+void upload_geometry(voxelizer::mesh& mesh, voxelizer::mesh_desc const& desc)
+{
+	glm::vec4 const defaults[voxelizer::mesh::attribute::Count]{
+		glm::vec4(0.0f), // POSITION
+		glm::vec4(0.0f), // NORMAL
+		glm::vec4(0.0f), // UV
+		glm::vec4(1.0f)  // COLOR
+	};
+
+	// The caller arrays are uploaded once, into the buffer of the first attribute sourcing them
+	std::unordered_map<void const*, size_t> array_sizes;
+	for (voxelizer::vertex_attribute_source const& source : desc.m_attributes)
+	{
+		if (source.is_set() && source.m_data != nullptr)
+		{
+			size_t& size = array_sizes[source.m_data];
+			size = glm::max(size, source.m_offset + get_attribute_size(source, desc.m_vertex_count));
+		}
+	}
+
+	std::unordered_map<void const*, GLuint> array_buffers;
+
+	glBindVertexArray(mesh.m_vao);
+
+	for (uint32_t i = 0; i < voxelizer::mesh::attribute::Count; i++)
+	{
+		auto attribute = (voxelizer::mesh::attribute) i;
+		voxelizer::vertex_attribute_source const& source = desc.m_attributes[i];
+
+		if (!source.is_set())
+		{
+			set_constant_vertex_attribute(mesh, attribute, defaults[i], desc.m_vertex_count);
+			continue;
+		}
+
+		GLuint buffer = source.m_buffer;
+
+		if (source.m_data != nullptr)
+		{
+			auto [found, inserted] = array_buffers.emplace(source.m_data, mesh.m_vbos[i]);
+			if (inserted)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, mesh.m_vbos[i]);
+				glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) array_sizes[source.m_data], source.m_data, GL_STATIC_DRAW);
+			}
+
+			buffer = found->second;
+		}
+
+		set_vertex_attribute(attribute, buffer, source);
+
+		// The mesh only owns the buffers it uploaded to
+		if (buffer != mesh.m_vbos[i])
+		{
+			glDeleteBuffers(1, &mesh.m_vbos[i]);
+			mesh.m_vbos[i] = NULL;
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Indices
+	voxelizer::index_source const& indices = desc.m_indices;
+	size_t index_size = indices.m_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+	if (indices.m_data != nullptr)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) (indices.m_count * index_size), (uint8_t const*) indices.m_data + indices.m_offset, GL_STATIC_DRAW);
+	}
+	else
+	{
+		glDeleteBuffers(1, &mesh.m_ebo);
+
+		mesh.m_ebo = indices.m_buffer;
+		mesh.m_index_offset = indices.m_offset;
+		mesh.m_borrowed_ebo = true;
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_ebo);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void grow_transformed_min_max(voxelizer::mesh& mesh, glm::vec3 const& position)
+{
+	glm::vec3 transformed_position = glm::vec3(mesh.m_transform * glm::vec4(position, 1.0f));
+
+	mesh.m_transformed_min = glm::min(mesh.m_transformed_min, transformed_position);
+	mesh.m_transformed_max = glm::max(mesh.m_transformed_max, transformed_position);
+}
+
+/// From the caller bounds (their transformed corners, so the result is conservative under rotations), the caller array or
+/// the host copy of the positions, never reading back the GL buffers.
+void calc_transformed_min_max(voxelizer::mesh& mesh, voxelizer::mesh_desc const& desc)
+{
+	voxelizer::vertex_attribute_source const& positions = desc.m_attributes[voxelizer::mesh::attribute::POSITION];
+
+	mesh.m_transformed_min = glm::vec3(std::numeric_limits<float>::infinity());
+	mesh.m_transformed_max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+	if (desc.m_has_bounds)
+	{
+		for (int corner = 0; corner < 8; corner++)
+			grow_transformed_min_max(mesh, glm::vec3(
+				corner & 1 ? desc.m_max.x : desc.m_min.x,
+				corner & 2 ? desc.m_max.y : desc.m_min.y,
+				corner & 4 ? desc.m_max.z : desc.m_min.z
+			));
+	}
+	else if (positions.m_data != nullptr)
+	{
+		uint8_t const* data = (uint8_t const*) positions.m_data + positions.m_offset;
+		size_t stride = get_element_stride(positions);
+
+		for (size_t i = 0; i < desc.m_vertex_count; i++)
+		{
+			glm::vec4 position(0.0f, 0.0f, 0.0f, 1.0f);
+			std::memcpy(&position[0], data + i * stride, positions.m_component_count * sizeof(float));
+
+			grow_transformed_min_max(mesh, glm::vec3(position));
+		}
+	}
+	else
+	{
+		for (glm::vec3 const& position : mesh.m_positions)
+			grow_transformed_min_max(mesh, position);
+	}
+}
+
+voxelizer::scene_builder::scene_builder(voxelizer::scene& scene) :
+	m_scene(scene)
+{
+	m_scene.m_transformed_min = glm::vec3(std::numeric_limits<float>::infinity());
+	m_scene.m_transformed_max = glm::vec3(-std::numeric_limits<float>::infinity());
+}
+
+voxelizer::mesh& voxelizer::scene_builder::add_mesh(mesh_desc const& desc)
+{
+	for (vertex_attribute_source const& source : desc.m_attributes)
+	{
+		if (source.is_set() && source.m_component_count > 4)
+			throw std::invalid_argument("Vertex attributes have at most 4 components");
+	}
+
+	if (!desc.m_attributes[mesh::attribute::POSITION].is_set())
+		throw std::invalid_argument("The mesh positions are required");
+
+	if (desc.m_attributes[mesh::attribute::POSITION].m_data == nullptr && !desc.m_has_bounds && !m_keep_host_data)
+		throw std::invalid_argument("The bounds of the mesh are required when its positions are in a GL buffer");
+
+	index_source const& indices = desc.m_indices;
+
+	if (indices.m_type != GL_UNSIGNED_INT && indices.m_type != GL_UNSIGNED_SHORT)
+		throw std::invalid_argument("The indices must be either GL_UNSIGNED_INT or GL_UNSIGNED_SHORT");
+
+	if (indices.m_count % 3 != 0 || (indices.m_count > 0 && indices.m_data == nullptr && indices.m_buffer == NULL))
+		throw std::invalid_argument("The indices must be a triangle list");
+
+	voxelizer::mesh mesh(m_upload_to_gpu);
+
+	mesh.m_triangle_count = indices.m_count / 3;
+	mesh.m_element_count = indices.m_count;
+	mesh.m_vertex_count = desc.m_vertex_count;
+	mesh.m_index_type = indices.m_type;
+	mesh.m_transform = desc.m_transform;
+	mesh.m_material = desc.m_material ? desc.m_material : get_default_material();
+
+	if (m_upload_to_gpu)
+	{
+		upload_geometry(mesh, desc);
+	}
+
+	if (m_keep_host_data)
+	{
+		copy_host_attribute(mesh.m_positions, desc.m_attributes[mesh::attribute::POSITION], desc.m_vertex_count);
+		copy_host_attribute(mesh.m_normals, desc.m_attributes[mesh::attribute::NORMAL], desc.m_vertex_count);
+		copy_host_attribute(mesh.m_uvs, desc.m_attributes[mesh::attribute::UV], desc.m_vertex_count);
+		copy_host_attribute(mesh.m_colors, desc.m_attributes[mesh::attribute::COLOR], desc.m_vertex_count);
+
+		size_t index_size = indices.m_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+		std::vector<uint8_t> storage;
+		uint8_t const* data = read_source(indices.m_data, indices.m_buffer, indices.m_offset, indices.m_count * index_size, storage);
+
+		mesh.m_indices.resize(indices.m_count);
+
+		if (indices.m_type == GL_UNSIGNED_SHORT)
+		{
+			for (size_t i = 0; i < indices.m_count; i++)
+			{
+				GLushort index;
+				std::memcpy(&index, data + i * sizeof(GLushort), sizeof(GLushort));
+				mesh.m_indices[i] = index;
+			}
+		}
+		else
+		{
+			std::memcpy(mesh.m_indices.data(), data, indices.m_count * sizeof(GLuint));
+		}
+	}
+
+	calc_transformed_min_max(mesh, desc);
+
+	m_scene.m_transformed_min = glm::min(m_scene.m_transformed_min, mesh.m_transformed_min);
+	m_scene.m_transformed_max = glm::max(m_scene.m_transformed_max, mesh.m_transformed_max);
+
+	m_scene.m_meshes.push_back(std::move(mesh));
+	return m_scene.m_meshes.back();
+}
+
+std::shared_ptr<voxelizer::material::texture> voxelizer::scene_builder::create_texture(int width, int height, void const* rgba8_data) const
+{
+	auto texture = std::make_shared<material::texture>(m_upload_to_gpu);
+
+	if (m_upload_to_gpu)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture->m_name);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba8_data);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	if (m_keep_host_data)
+	{
+		texture->m_image.m_width = width;
+		texture->m_image.m_height = height;
+		texture->m_image.m_data.assign((uint8_t const*) rgba8_data, (uint8_t const*) rgba8_data + size_t(width) * height * 4);
+	}
+
+	return texture;
+}
+
+std::shared_ptr<voxelizer::material> const& voxelizer::scene_builder::get_default_material()
+{
+	if (m_default_material)
+		return m_default_material;
+
+	uint8_t const white[4]{255, 255, 255, 255};
+	std::shared_ptr<material::texture> texture = create_texture(1, 1, white);
+
+	m_default_material = std::make_shared<material>(false);
+
+	for (uint32_t type = 0; type < material::type::Count; type++)
+	{
+		m_default_material->get_color((material::type) type) = glm::vec4(1.0f);
+		m_default_material->set_texture((material::type) type, texture);
+	}
+
+	return m_default_material;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "scene.hpp"
+
+namespace voxelizer
+{
+	/// Where a vertex attribute is read from: either a caller array or a caller GL buffer, in both cases with any offset and
+	/// stride (so interleaved vertices are described by several attributes on the same array). Only float components.
+	struct vertex_attribute_source
+	{
+		void const* m_data = nullptr; // Host array, uploaded once (attributes on the same array share the GL buffer).
+		GLuint m_buffer = NULL;       // GL buffer, referenced by the mesh as is (not copied nor owned).
+		size_t m_offset = 0;          // Byte offset of the first element within m_data or m_buffer.
+		size_t m_stride = 0;          // Byte distance between two elements, 0 if tightly packed.
+		GLint m_component_count = 0;  // The float components of an element, the missing ones default to (0, 0, 0, 1).
+
+		bool is_set() const
+		{
+			return (m_data != nullptr || m_buffer != NULL) && m_component_count > 0;
+		}
+	};
+
+	struct index_source
+	{
+		void const* m_data = nullptr;
+		GLuint m_buffer = NULL;
+		size_t m_offset = 0;
+		GLenum m_type = GL_UNSIGNED_INT; // Or GL_UNSIGNED_SHORT.
+		size_t m_count = 0;              // A multiple of 3, the indices are read as a triangle list.
+	};
+
+	struct mesh_desc
+	{
+		size_t m_vertex_count = 0;
+		vertex_attribute_source m_attributes[mesh::attribute::Count]; // POSITION is required, the others are optional.
+		index_source m_indices;
+
+		glm::mat4 m_transform = glm::mat4(1.0f);
+		std::shared_ptr<material> m_material; // If null, the white default material of the builder.
+
+		// The bounds of the positions (before m_transform), required when they're sourced from a GL buffer unless the builder
+		// keeps the host data: otherwise they'd be read back from the GPU just for this.
+		bool m_has_bounds = false;
+		glm::vec3 m_min = glm::vec3(0.0f);
+		glm::vec3 m_max = glm::vec3(0.0f);
+	};
+
+	/// Builds the meshes of a scene from geometry the caller already has in memory or in GL buffers, as an alternative to
+	/// assimp_scene_loader. Meshes sourced from GL buffers are voxelized on the GPU with no copy at all, the buffers must
+	/// outlive the scene (the scene_batch, if any, copies them on the GPU).
+	class scene_builder
+	{
+	public:
+		bool m_upload_to_gpu = true;   // Creates the GL objects needed by the GPU backend.
+		bool m_keep_host_data = false; // Keeps a packed host-side copy of the geometry, needed by the CPU backend.
+
+		/// Clears the bounds of the scene, that are then grown by every mesh added.
+		explicit scene_builder(voxelizer::scene& scene);
+		scene_builder(scene_builder const&) = delete;
+
+		voxelizer::mesh& add_mesh(mesh_desc const& desc);
+
+		/// A texture from a caller RGBA8 image, to build materials with.
+		std::shared_ptr<material::texture> create_texture(int width, int height, void const* rgba8_data) const;
+
+		/// White color and texture on every slot, created on first use.
+		std::shared_ptr<material> const& get_default_material();
+
+	private:
+		voxelizer::scene& m_scene;
+		std::shared_ptr<material> m_default_material;
+	};
+}
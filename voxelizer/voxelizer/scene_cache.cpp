@@ -0,0 +1,485 @@
+#include "scene_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+// File layout: header, texture table, material table, mesh table, then the data the tables point to (16 bytes aligned)
+
+constexpr char k_scene_cache_magic[4] = { 'V', 'X', 'S', 'C' };
+constexpr size_t k_data_alignment = 16;
+
+struct cache_header
+{
+	char m_magic[4];
+	uint32_t m_version;
+	uint64_t m_key;
+	uint32_t m_texture_count;
+	uint32_t m_material_count;
+	uint32_t m_mesh_count;
+	uint32_t m_padding;
+};
+
+struct cache_texture
+{
+	int32_t m_width, m_height;
+	uint64_t m_offset; // RGBA8 data.
+};
+
+struct cache_material
+{
+	glm::vec4 m_colors[voxelizer::material::type::Count];
+	int32_t m_textures[voxelizer::material::type::Count]; // Index in the texture table, -1 if the slot is empty.
+	int32_t m_padding[3];
+};
+
+enum cache_array
+{
+	POSITIONS, // glm::vec3
+	NORMALS,   // glm::vec3
+	UVS,       // glm::vec2
+	COLORS,    // glm::vec4
+	INDICES,   // GLuint
+
+	Count
+};
+
+struct cache_mesh
+{
+	glm::mat4 m_transform;
+	glm::vec3 m_transformed_min;
+	uint32_t m_material; // Index in the material table.
+	glm::vec3 m_transformed_max;
+	uint32_t m_padding;
+	uint64_t m_vertex_count;
+	uint64_t m_index_count;
+	uint64_t m_offsets[cache_array::Count]; // 0 if the mesh doesn't have the array.
+};
+
+size_t align_offset(size_t offset)
+{
+	return (offset + k_data_alignment - 1) / k_data_alignment * k_data_alignment;
+}
+
+/// The data section is planned first (so that the tables can point into it) and then written in the same order.
+struct data_writer
+{
+	size_t m_offset;
+	std::vector<std::pair<void const*, size_t>> m_chunks;
+
+	uint64_t add(void const* data, size_t size)
+	{
+		if (size == 0)
+			return 0;
+
+		m_offset = align_offset(m_offset);
+		m_chunks.emplace_back(data, size);
+
+		uint64_t offset = m_offset;
+		m_offset += size;
+		return offset;
+	}
+};
+
+/// Sets the vertex attribute from the mapped array or, if the mesh doesn't have it, to a constant value (as the
+/// assimp_scene_loader does).
+void load_vertex_attribute(
+	voxelizer::mesh& mesh,
+	voxelizer::mesh::attribute attribute,
+	GLint component_count,
+	void const* data,
+	size_t vertex_count,
+	glm::vec4 const& default_value
+)
+{
+	glBindVertexArray(mesh.m_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.m_vbos[attribute]);
+
+	glEnableVertexAttribArray(attribute);
+
+	if (data != nullptr)
+	{
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (vertex_count * component_count * sizeof(GLfloat)), data, GL_STATIC_DRAW);
+
+		glVertexAttribPointer(attribute, component_count, GL_FLOAT, GL_FALSE, component_count * sizeof(GLfloat), 0);
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, component_count * sizeof(GLfloat), &default_value[0], GL_STATIC_DRAW);
+
+		glVertexAttribPointer(attribute, component_count, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribDivisor(attribute, (GLuint) vertex_count);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+/// Whether the array of the data section lies within the file (0 offsets stand for missing arrays).
+bool is_valid_range(uint64_t offset, uint64_t size, size_t file_size)
+{
+	return offset == 0 || size == 0 || (offset <= file_size && size <= file_size - offset);
+}
+
+template<typename _type>
+void copy_array(std::vector<_type>& array, void const* data, size_t count)
+{
+	if (data != nullptr)
+		array.assign((_type const*) data, (_type const*) data + count);
+}
+
+uint64_t voxelizer::hash_file(std::filesystem::path const& path)
+{
+	voxelizer::mapped_file file(path);
+
+	uint64_t const prime = 0x100000001b3;
+	uint64_t hash = 0xcbf29ce484222325;
+
+	size_t word_count = file.m_size / sizeof(uint64_t);
+	for (size_t i = 0; i < word_count; i++)
+	{
+		uint64_t word;
+		std::memcpy(&word, file.m_data + i * sizeof(uint64_t), sizeof(uint64_t));
+		hash = (hash ^ word) * prime;
+	}
+
+	for (size_t i = word_count * sizeof(uint64_t); i < file.m_size; i++)
+		hash = (hash ^ file.m_data[i]) * prime;
+
+	return (hash ^ file.m_size) * prime;
+}
+
+void voxelizer::write_scene_cache(std::filesystem::path const& path, uint64_t key, voxelizer::scene const& scene)
+{
+	std::vector<voxelizer::material const*> materials;
+	std::vector<voxelizer::material::texture const*> textures;
+
+	std::unordered_map<voxelizer::material const*, uint32_t> material_indices;
+	std::unordered_map<voxelizer::material::texture const*, int32_t> texture_indices;
+
+	for (voxelizer::mesh const& mesh : scene.m_meshes)
+	{
+		if (!material_indices.emplace(mesh.m_material.get(), (uint32_t) materials.size()).second)
+			continue;
+
+		materials.push_back(mesh.m_material.get());
+
+		for (uint32_t type = 0; type < voxelizer::material::type::Count; type++)
+		{
+			voxelizer::material::texture const* texture = mesh.m_material->get_shared_texture((voxelizer::material::type) type).get();
+			if (texture != nullptr && texture_indices.emplace(texture, (int32_t) textures.size()).second)
+				textures.push_back(texture);
+		}
+	}
+
+	// Tables
+	cache_header header{};
+	std::memcpy(header.m_magic, k_scene_cache_magic, sizeof(header.m_magic));
+	header.m_version = k_scene_cache_version;
+	header.m_key = key;
+	header.m_texture_count = (uint32_t) textures.size();
+	header.m_material_count = (uint32_t) materials.size();
+	header.m_mesh_count = (uint32_t) scene.m_meshes.size();
+
+	std::vector<cache_texture> cache_textures(textures.size());
+	std::vector<cache_material> cache_materials(materials.size());
+	std::vector<cache_mesh> cache_meshes(scene.m_meshes.size());
+
+	data_writer data{};
+	data.m_offset = sizeof(cache_header)
+		+ cache_textures.size() * sizeof(cache_texture)
+		+ cache_materials.size() * sizeof(cache_material)
+		+ cache_meshes.size() * sizeof(cache_mesh);
+
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		voxelizer::material::image const& image = textures[i]->m_image;
+
+		cache_textures[i].m_width = image.m_width;
+		cache_textures[i].m_height = image.m_height;
+		cache_textures[i].m_offset = data.add(image.m_data.data(), image.m_data.size());
+	}
+
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		for (uint32_t type = 0; type < voxelizer::material::type::Count; type++)
+		{
+			cache_materials[i].m_colors[type] = materials[i]->get_color((voxelizer::material::type) type);
+
+			voxelizer::material::texture const* texture = materials[i]->get_shared_texture((voxelizer::material::type) type).get();
+			cache_materials[i].m_textures[type] = texture != nullptr ? texture_indices.at(texture) : -1;
+		}
+	}
+
+	for (size_t i = 0; i < scene.m_meshes.size(); i++)
+	{
+		voxelizer::mesh const& mesh = scene.m_meshes[i];
+		cache_mesh& cache_mesh = cache_meshes[i];
+
+		if (mesh.m_indices.size() != mesh.m_element_count)
+			throw std::invalid_argument("The meshes of a cached scene must have their host-side copy");
+
+		cache_mesh.m_transform = mesh.m_transform;
+		cache_mesh.m_transformed_min = mesh.m_transformed_min;
+		cache_mesh.m_transformed_max = mesh.m_transformed_max;
+		cache_mesh.m_material = material_indices.at(mesh.m_material.get());
+		cache_mesh.m_vertex_count = mesh.m_positions.size();
+		cache_mesh.m_index_count = mesh.m_indices.size();
+
+		cache_mesh.m_offsets[cache_array::POSITIONS] = data.add(mesh.m_positions.data(), mesh.m_positions.size() * sizeof(glm::vec3));
+		cache_mesh.m_offsets[cache_array::NORMALS] = data.add(mesh.m_normals.data(), mesh.m_normals.size() * sizeof(glm::vec3));
+		cache_mesh.m_offsets[cache_array::UVS] = data.add(mesh.m_uvs.data(), mesh.m_uvs.size() * sizeof(glm::vec2));
+		cache_mesh.m_offsets[cache_array::COLORS] = data.add(mesh.m_colors.data(), mesh.m_colors.size() * sizeof(glm::vec4));
+		cache_mesh.m_offsets[cache_array::INDICES] = data.add(mesh.m_indices.data(), mesh.m_indices.size() * sizeof(GLuint));
+	}
+
+	// Writing, to a temporary file moved in place once complete: a cache left incomplete by a crash (or a full disk) would
+	// have a valid key
+	std::filesystem::path temp_path = path;
+	temp_path += ".tmp";
+
+	std::ofstream output_file_stream(temp_path, std::ios::binary);
+	if (!output_file_stream)
+		throw std::runtime_error("Failed to open the scene cache: " + temp_path.u8string());
+
+	output_file_stream.write((char const*) &header, sizeof(cache_header));
+	output_file_stream.write((char const*) cache_textures.data(), cache_textures.size() * sizeof(cache_texture));
+	output_file_stream.write((char const*) cache_materials.data(), cache_materials.size() * sizeof(cache_material));
+	output_file_stream.write((char const*) cache_meshes.data(), cache_meshes.size() * sizeof(cache_mesh));
+
+	char const padding[k_data_alignment]{};
+
+	for (auto const& [chunk, size] : data.m_chunks)
+	{
+		size_t position = (size_t) output_file_stream.tellp();
+		output_file_stream.write(padding, align_offset(position) - position);
+		output_file_stream.write((char const*) chunk, size);
+	}
+
+	output_file_stream.close();
+
+	if (!output_file_stream)
+	{
+		std::error_code error;
+		std::filesystem::remove(temp_path, error);
+
+		throw std::runtime_error("Failed to write the scene cache: " + temp_path.u8string());
+	}
+
+	std::filesystem::rename(temp_path, path);
+
+	printf("[scene_cache] Written \"%s\", meshes: %zu, materials: %zu, textures: %zu, size: %zu\n",
+		path.u8string().c_str(),
+		scene.m_meshes.size(),
+		materials.size(),
+		textures.size(),
+		data.m_offset
+	);
+}
+
+bool voxelizer::read_scene_cache(
+	std::filesystem::path const& path,
+	uint64_t key,
+	voxelizer::scene& scene,
+	bool upload_to_gpu,
+	bool keep_host_data
+)
+{
+	if (!std::filesystem::is_regular_file(path))
+		return false;
+
+	voxelizer::mapped_file file(path);
+
+	// Validation, any mismatch means the cache is stale
+	cache_header header{};
+	if (file.m_size < sizeof(cache_header))
+		return false;
+
+	std::memcpy(&header, file.m_data, sizeof(cache_header));
+
+	if (std::memcmp(header.m_magic, k_scene_cache_magic, sizeof(header.m_magic)) != 0 || header.m_version != k_scene_cache_version || header.m_key != key)
+		return false;
+
+	size_t tables_size = sizeof(cache_header)
+		+ size_t(header.m_texture_count) * sizeof(cache_texture)
+		+ size_t(header.m_material_count) * sizeof(cache_material)
+		+ size_t(header.m_mesh_count) * sizeof(cache_mesh);
+
+	if (file.m_size < tables_size)
+	{
+		printf("[scene_cache] Truncated \"%s\", ignored\n", path.u8string().c_str());
+		return false;
+	}
+
+	auto cache_textures = (cache_texture const*) (file.m_data + sizeof(cache_header));
+	auto cache_materials = (cache_material const*) (cache_textures + header.m_texture_count);
+	auto cache_meshes = (cache_mesh const*) (cache_materials + header.m_material_count);
+
+	// The whole file is checked before anything is loaded, a corrupted cache is a miss as well
+	bool valid = true;
+
+	for (uint32_t i = 0; i < header.m_texture_count; i++)
+	{
+		cache_texture const& cache_texture = cache_textures[i];
+		if (cache_texture.m_width < 0 || cache_texture.m_height < 0)
+		{
+			valid = false;
+			break;
+		}
+
+		uint64_t pixel_count = uint64_t(cache_texture.m_width) * uint64_t(cache_texture.m_height);
+		valid &= pixel_count <= file.m_size && is_valid_range(cache_texture.m_offset, pixel_count * 4, file.m_size);
+	}
+
+	for (uint32_t i = 0; i < header.m_mesh_count; i++)
+	{
+		cache_mesh const& cache_mesh = cache_meshes[i];
+		valid &= cache_mesh.m_material < header.m_material_count;
+
+		// The counts are bounded first, so that the sizes below can't overflow
+		valid &= cache_mesh.m_vertex_count <= file.m_size && cache_mesh.m_index_count <= file.m_size;
+		if (!valid)
+			break;
+
+		valid &= is_valid_range(cache_mesh.m_offsets[cache_array::POSITIONS], cache_mesh.m_vertex_count * sizeof(glm::vec3), file.m_size);
+		valid &= is_valid_range(cache_mesh.m_offsets[cache_array::NORMALS], cache_mesh.m_vertex_count * sizeof(glm::vec3), file.m_size);
+		valid &= is_valid_range(cache_mesh.m_offsets[cache_array::UVS], cache_mesh.m_vertex_count * sizeof(glm::vec2), file.m_size);
+		valid &= is_valid_range(cache_mesh.m_offsets[cache_array::COLORS], cache_mesh.m_vertex_count * sizeof(glm::vec4), file.m_size);
+		valid &= is_valid_range(cache_mesh.m_offsets[cache_array::INDICES], cache_mesh.m_index_count * sizeof(GLuint), file.m_size);
+	}
+
+	if (!valid)
+	{
+		printf("[scene_cache] Corrupted \"%s\", ignored\n", path.u8string().c_str());
+		return false;
+	}
+
+	auto get_data = [&](uint64_t offset, size_t size) -> void const*
+	{
+		return offset != 0 && size != 0 ? file.m_data + offset : nullptr;
+	};
+
+	// Textures
+	std::vector<std::shared_ptr<voxelizer::material::texture>> textures(header.m_texture_count);
+
+	for (uint32_t i = 0; i < header.m_texture_count; i++)
+	{
+		cache_texture const& cache_texture = cache_textures[i];
+		void const* image_data = get_data(cache_texture.m_offset, size_t(cache_texture.m_width) * cache_texture.m_height * 4);
+
+		textures[i] = std::make_shared<voxelizer::material::texture>(upload_to_gpu);
+
+		if (image_data == nullptr)
+			continue;
+
+		if (upload_to_gpu)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[i]->m_name);
+
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cache_texture.m_width, cache_texture.m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+
+		if (keep_host_data)
+		{
+			voxelizer::material::image& image = textures[i]->m_image;
+			image.m_width = cache_texture.m_width;
+			image.m_height = cache_texture.m_height;
+			copy_array(image.m_data, image_data, size_t(image.m_width) * image.m_height * 4);
+		}
+	}
+
+	// Materials
+	std::vector<std::shared_ptr<voxelizer::material>> materials(header.m_material_count);
+
+	for (uint32_t i = 0; i < header.m_material_count; i++)
+	{
+		materials[i] = std::make_shared<voxelizer::material>(false);
+
+		for (uint32_t type = 0; type < voxelizer::material::type::Count; type++)
+		{
+			materials[i]->get_color((voxelizer::material::type) type) = cache_materials[i].m_colors[type];
+
+			int32_t texture_idx = cache_materials[i].m_textures[type];
+			if (texture_idx >= 0 && (uint32_t) texture_idx < header.m_texture_count)
+				materials[i]->set_texture((voxelizer::material::type) type, textures[texture_idx]);
+		}
+	}
+
+	// Meshes
+	scene.m_meshes.clear();
+	scene.m_meshes.reserve(header.m_mesh_count);
+
+	scene.m_transformed_min = glm::vec3(std::numeric_limits<float>::infinity());
+	scene.m_transformed_max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+	for (uint32_t i = 0; i < header.m_mesh_count; i++)
+	{
+		cache_mesh const& cache_mesh = cache_meshes[i];
+		size_t vertex_count = cache_mesh.m_vertex_count;
+
+		void const* positions = get_data(cache_mesh.m_offsets[cache_array::POSITIONS], vertex_count * sizeof(glm::vec3));
+		void const* normals = get_data(cache_mesh.m_offsets[cache_array::NORMALS], vertex_count * sizeof(glm::vec3));
+		void const* uvs = get_data(cache_mesh.m_offsets[cache_array::UVS], vertex_count * sizeof(glm::vec2));
+		void const* colors = get_data(cache_mesh.m_offsets[cache_array::COLORS], vertex_count * sizeof(glm::vec4));
+		void const* indices = get_data(cache_mesh.m_offsets[cache_array::INDICES], cache_mesh.m_index_count * sizeof(GLuint));
+
+		voxelizer::mesh mesh(upload_to_gpu);
+
+		mesh.m_triangle_count = cache_mesh.m_index_count / 3;
+		mesh.m_element_count = cache_mesh.m_index_count;
+		mesh.m_vertex_count = vertex_count;
+		mesh.m_transform = cache_mesh.m_transform;
+		mesh.m_transformed_min = cache_mesh.m_transformed_min;
+		mesh.m_transformed_max = cache_mesh.m_transformed_max;
+
+		mesh.m_material = materials[cache_mesh.m_material];
+
+		if (upload_to_gpu)
+		{
+			load_vertex_attribute(mesh, voxelizer::mesh::attribute::POSITION, 3, positions, vertex_count, glm::vec4(0));
+			load_vertex_attribute(mesh, voxelizer::mesh::attribute::NORMAL, 3, normals, vertex_count, glm::vec4(0));
+			load_vertex_attribute(mesh, voxelizer::mesh::attribute::UV, 2, uvs, vertex_count, glm::vec4(0));
+			load_vertex_attribute(mesh, voxelizer::mesh::attribute::COLOR, 4, colors, vertex_count, glm::vec4(1));
+
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_ebo);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) (mesh.m_element_count * sizeof(GLuint)), indices, GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, NULL);
+		}
+
+		if (keep_host_data)
+		{
+			copy_array(mesh.m_positions, positions, vertex_count);
+			copy_array(mesh.m_normals, normals, vertex_count);
+			copy_array(mesh.m_uvs, uvs, vertex_count);
+			copy_array(mesh.m_colors, colors, vertex_count);
+			copy_array(mesh.m_indices, indices, mesh.m_element_count);
+		}
+
+		scene.m_transformed_min = glm::min(scene.m_transformed_min, mesh.m_transformed_min);
+		scene.m_transformed_max = glm::max(scene.m_transformed_max, mesh.m_transformed_max);
+
+		scene.m_meshes.push_back(std::move(mesh));
+	}
+
+	printf("[scene_cache] Loaded \"%s\", meshes: %zu, materials: %zu, textures: %zu\n",
+		path.u8string().c_str(),
+		scene.m_meshes.size(),
+		materials.size(),
+		textures.size()
+	);
+
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "scene.hpp"
+
+namespace voxelizer
+{
+	// A scene cache holds the meshes as loaded (flattened, triangulated, with their transform), their materials and the
+	// decoded RGBA8 textures. It's written in the host byte order and only meant to be read back on the same machine.
+	constexpr uint32_t k_scene_cache_version = 1;
+
+	/// Hashes the content of the file (FNV-1a over 64-bit words), to key the caches of the scenes loaded from it.
+	uint64_t hash_file(std::filesystem::path const& path);
+
+	/// The meshes and the textures must have their host-side copy (see assimp_scene_loader::m_keep_host_data). The file is
+	/// written aside and renamed to `path` once complete.
+	void write_scene_cache(std::filesystem::path const& path, uint64_t key, voxelizer::scene const& scene);
+
+	/**
+	 * Loads the scene from the cache, the file is memory-mapped and its arrays given directly to glBufferData/glTexImage2D.
+	 * @return False if the cache doesn't exist, was written with another key or version or is corrupted (the scene is left
+	 * untouched).
+	 */
+	bool read_scene_cache(
+		std::filesystem::path const& path,
+		uint64_t key,
+		voxelizer::scene& scene,
+		bool upload_to_gpu,
+		bool keep_host_data
+	);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define VOXELIZER_X86
+
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#endif
+	#include <immintrin.h>
+#endif
+
+// Functions tagged with VOXELIZER_TARGET_AVX2 are compiled for AVX2 regardless of the global compiler flags, callers
+// must check voxelizer::simd::has_avx2() first. MSVC doesn't need it as it always accepts the intrinsics.
+#if defined(VOXELIZER_X86) && (defined(__GNUC__) || defined(__clang__))
+	#define VOXELIZER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+	#define VOXELIZER_TARGET_BMI2 __attribute__((target("bmi2")))
+#else
+	#define VOXELIZER_TARGET_AVX2
+	#define VOXELIZER_TARGET_BMI2
+#endif
+
+// Templates shared by the SSE and AVX2 paths are tagged with VOXELIZER_FORCE_INLINE, so that they're compiled within the
+// (VOXELIZER_TARGET_AVX2) function instantiating them rather than as standalone functions for the default target.
+#if defined(_MSC_VER)
+	#define VOXELIZER_FORCE_INLINE __forceinline
+#else
+	#define VOXELIZER_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace voxelizer::simd
+{
+	inline uint32_t count_trailing_zeros(uint32_t value)
+	{
+#if defined(_MSC_VER)
+		unsigned long result;
+		_BitScanForward(&result, value);
+		return (uint32_t) result;
+#else
+		return (uint32_t) __builtin_ctz(value);
+#endif
+	}
+
+	inline bool has_avx2()
+	{
+#if defined(VOXELIZER_X86)
+		static bool const result = []
+		{
+	#if defined(_MSC_VER)
+			int info[4]{};
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+
+			__cpuidex(info, 7, 0);
+			bool avx2 = (info[1] & (1 << 5)) != 0;
+
+			__cpuid(info, 1);
+			bool fma = (info[2] & (1 << 12)) != 0;
+			bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+
+			return avx2 && fma && os_saves_ymm;
+	#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	#endif
+		}();
+		return result;
+#else
+		return false;
+#endif
+	}
+
+	/// Whether the CPU has BMI2 and runs pdep/pext in hardware: AMD microcodes them before Zen 3 (family 19h), where they take
+	/// tens of cycles and are slower than the plain bit tricks.
+	inline bool has_fast_bmi2()
+	{
+#if defined(VOXELIZER_X86)
+		static bool const result = []
+		{
+	#if defined(_MSC_VER)
+			int info[4]{};
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+
+			bool amd = info[1] == 0x68747541; // "Auth"enticAMD
+
+			__cpuidex(info, 7, 0);
+			bool bmi2 = (info[1] & (1 << 8)) != 0;
+
+			__cpuid(info, 1);
+			uint32_t family = ((info[0] >> 8) & 0xf) + ((info[0] >> 20) & 0xff);
+
+			return bmi2 && !(amd && family < 0x19);
+	#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
+	#endif
+		}();
+		return result;
+#else
+		return false;
+#endif
+	}
+}
@@ -0,0 +1,143 @@
+#include "tiled_voxelize.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+#include "octree_io.hpp"
+
+uint32_t voxelizer::tiled_voxelize::operator()(
+	std::vector<GLuint>& octree,
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size
+)
+{
+	glm::uvec3 grid = voxelizer::voxelize::calc_proportional_grid(area_size, voxels_on_y);
+	uint32_t max_side = glm::max(glm::max(grid.x, grid.y), grid.z);
+	uint32_t resolution = glm::max((uint32_t) glm::ceil(glm::log2((float) max_side)), 1u);
+
+	octree.clear();
+
+	build_state state{
+		octree,
+		scene,
+		voxels_on_y,
+		area_position,
+		area_size,
+		grid,
+		resolution
+	};
+
+	// The root is either the first split block or the first tile, both placed at the start of the octree
+	build_region(state, glm::uvec3(0), 0);
+
+	if (octree.empty())
+		octree.assign(8, 0); // Empty octree
+
+	printf("[tiled_voxelize] Octree stitched, resolution: %d, nodes: %zu\n", resolution, octree.size());
+
+	return resolution;
+}
+
+GLuint voxelizer::tiled_voxelize::build_region(build_state& state, glm::uvec3 region_min, uint32_t level)
+{
+	if (glm::any(glm::greaterThanEqual(region_min, state.m_grid)))
+		return 0;
+
+	uint32_t tile_resolution = state.m_resolution - level;
+	uint32_t side = 1u << tile_resolution;
+
+	bool is_min_tile = tile_resolution <= glm::max(m_min_tile_resolution, 1u);
+	size_t voxel_count;
+
+	if (level == 0)
+	{
+		// Single tile fast path: the whole volume is voxelized straight into a voxel-list, the count pass (and the split)
+		// are only needed if it's over budget, in which case the voxels are counted but not stored
+		voxelizer::voxel_list voxel_list{};
+		voxel_count = m_voxelize.try_voxelize(voxel_list, state.m_scene, state.m_voxels_on_y, state.m_area_position, state.m_area_size, region_min, side, is_min_tile ? SIZE_MAX : m_max_tile_voxels);
+
+		printf("[tiled_voxelize] Region (%d, %d, %d) of side %d, voxels: %zu\n", region_min.x, region_min.y, region_min.z, side, voxel_count);
+
+		if (voxel_count == 0)
+			return 0;
+
+		if (voxel_count <= m_max_tile_voxels || is_min_tile)
+			return append_tile(state, region_min, level, voxel_list);
+	}
+	else
+	{
+		voxel_count = m_voxelize.count(state.m_scene, state.m_voxels_on_y, state.m_area_position, state.m_area_size, region_min, side);
+
+		printf("[tiled_voxelize] Region (%d, %d, %d) of side %d, voxels: %zu\n", region_min.x, region_min.y, region_min.z, side, voxel_count);
+
+		if (voxel_count == 0)
+			return 0;
+
+		if (voxel_count <= m_max_tile_voxels || is_min_tile)
+		{
+			voxelizer::voxel_list voxel_list{};
+			m_voxelize(voxel_list, state.m_scene, state.m_voxels_on_y, state.m_area_position, state.m_area_size, region_min, side, voxel_count);
+
+			return append_tile(state, region_min, level, voxel_list);
+		}
+	}
+
+	// Over budget: splits the region in its 8 children, the block is allocated before them (as the octree_builder does)
+	size_t block = state.m_octree.size();
+	state.m_octree.resize(block + 8, 0);
+
+	bool is_empty = true;
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		glm::uvec3 child_min = region_min + glm::uvec3(i & 1, (i >> 1) & 1, (i >> 2) & 1) * (side / 2);
+
+		GLuint value = build_region(state, child_min, level + 1);
+		state.m_octree[block + i] = value;
+
+		is_empty &= value == 0;
+	}
+
+	if (is_empty)
+	{
+		state.m_octree.resize(block);
+		return 0;
+	}
+
+	return 0x80000000 | (GLuint) block;
+}
+
+GLuint voxelizer::tiled_voxelize::append_tile(build_state& state, glm::uvec3 region_min, uint32_t level, voxelizer::voxel_list& voxel_list)
+{
+	uint32_t tile_resolution = state.m_resolution - level;
+	uint32_t side = 1u << tile_resolution;
+
+	if (m_deduplicate)
+		m_voxel_list_dedup(voxel_list, tile_resolution);
+
+	voxelizer::octree tile{};
+	m_octree_builder.build(voxel_list, tile_resolution, tile);
+
+	std::vector<GLuint> tile_data = voxelizer::download_octree(tile);
+
+	glDeleteBuffers(1, &tile.m_buffer);
+
+	size_t base = state.m_octree.size();
+	if (base + tile_data.size() > 0x7fffffff)
+		throw std::runtime_error("Octree too large, node addresses exceed 31 bits");
+
+	// The tile is addressed from 0, relocates its addresses after the nodes already stitched
+	for (GLuint& value : tile_data)
+	{
+		if (voxelizer::octree::is_address(value))
+			value += (GLuint) base;
+	}
+
+	state.m_octree.insert(state.m_octree.end(), tile_data.begin(), tile_data.end());
+
+	printf("[tiled_voxelize] Tile (%d, %d, %d) of side %d stitched at %zu, nodes: %zu\n", region_min.x, region_min.y, region_min.z, side, base, tile_data.size());
+
+	return 0x80000000 | (GLuint) base;
+}
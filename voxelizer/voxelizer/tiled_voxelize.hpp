@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "octree_builder.hpp"
+#include "scene.hpp"
+#include "voxel_list.hpp"
+#include "voxel_list_dedup.hpp"
+#include "voxelize.hpp"
+
+namespace voxelizer
+{
+	/// Voxelizes the scene and builds its octree one tile at a time, so that the GPU only holds the voxel-list and the octree
+	/// of a single tile. Tiles are octree nodes: the volume is split recursively until the voxels of a tile fit the budget.
+	/// The sub-octrees are then stitched, on the host, into the final octree.
+	struct tiled_voxelize
+	{
+		voxelizer::voxelize m_voxelize;
+		voxelizer::voxel_list_dedup m_voxel_list_dedup;
+		voxelizer::octree_builder m_octree_builder;
+
+		static constexpr size_t k_default_max_tile_voxels = 1 << 24; // ~192 MB of voxel-list.
+
+		size_t m_max_tile_voxels = k_default_max_tile_voxels; // The max voxels (duplicates included) a tile is allowed to generate.
+		uint32_t m_min_tile_resolution = 4; // Tiles aren't split further than this, even if over budget.
+		bool m_deduplicate = true; // Merges the voxels with the same position before building a tile (see voxel_list_dedup).
+
+		/**
+		 * @param octree      The resulting octree, the nodes are addressed from its start (see octree::m_node_count).
+		 * @param scene       The scene to voxelize.
+		 * @param voxels_on_y Number of voxels along the Y axis.
+		 * @param offset      Where to start taking the voxelization area.
+		 * @param size        The size of the voxelization area.
+		 * @return The resolution of the octree.
+		 */
+		uint32_t operator()(
+			std::vector<GLuint>& octree,
+			voxelizer::scene const& scene,
+			uint32_t voxels_on_y,
+			glm::vec3 area_position,
+			glm::vec3 area_size
+		);
+
+	private:
+		struct build_state
+		{
+			std::vector<GLuint>& m_octree;
+			voxelizer::scene const& m_scene;
+			uint32_t m_voxels_on_y;
+			glm::vec3 m_area_position;
+			glm::vec3 m_area_size;
+			glm::uvec3 m_grid;
+			uint32_t m_resolution;
+		};
+
+		/// Builds the node for the given region and returns its value (for the parent node), 0 if empty.
+		GLuint build_region(build_state& state, glm::uvec3 region_min, uint32_t level);
+		/// Builds the sub-octree of the region from its voxel-list and appends it to the octree, returns its address.
+		GLuint append_tile(build_state& state, glm::uvec3 region_min, uint32_t level, voxelizer::voxel_list& voxel_list);
+	};
+}
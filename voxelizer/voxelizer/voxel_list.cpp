@@ -1,6 +1,7 @@
 #include "voxel_list.hpp"
 
 #include <iostream>
+#include <stdexcept>
 
 voxelizer::voxel_list::voxel_list()
 {}
@@ -8,16 +9,101 @@ voxelizer::voxel_list::voxel_list()
 void voxelizer::voxel_list::alloc(size_t size)
 {
 	m_size = size;
+	m_capacity = size;
 
-	m_position_buffer.load_data(size * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
-	m_position_buffer.set_format(GL_R32UI);
+	m_position_buffer.load_data(size * sizeof(GLuint) * 2, NULL, GL_DYNAMIC_DRAW);
+	m_position_buffer.set_format(GL_RG32UI);
 
 	m_color_buffer.load_data(size * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
 	m_color_buffer.set_format(GL_RGBA8);
 }
 
+void voxelizer::voxel_list::grow(size_t capacity, size_t kept)
+{
+	if (kept > m_size || kept > capacity)
+		throw std::invalid_argument("Can't keep more voxels than the voxel-list holds");
+
+	GLsizeiptr position_bytesize = (GLsizeiptr) (kept * sizeof(GLuint) * 2);
+	GLsizeiptr color_bytesize = (GLsizeiptr) (kept * sizeof(GLuint));
+
+	// The kept voxels are parked in a staging buffer while the voxel-list buffers are reallocated
+	GLuint staging = 0;
+	if (kept > 0)
+	{
+		glGenBuffers(1, &staging);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, staging);
+		glBufferData(GL_COPY_WRITE_BUFFER, position_bytesize + color_bytesize, NULL, GL_STREAM_COPY);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, m_position_buffer.m_buffer_name);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, position_bytesize);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, m_color_buffer.m_buffer_name);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, position_bytesize, color_bytesize);
+	}
+
+	alloc(capacity);
+	m_size = kept;
+
+	if (kept > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, staging);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_position_buffer.m_buffer_name);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, position_bytesize);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_color_buffer.m_buffer_name);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, position_bytesize, 0, color_bytesize);
+
+		glDeleteBuffers(1, &staging);
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
 void voxelizer::voxel_list::bind(GLuint position_binding, GLuint color_binding) const
 {
-	m_position_buffer.bind(position_binding, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGB10_A2UI);
+	m_position_buffer.bind(position_binding, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32UI);
 	m_color_buffer.bind(color_binding, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
 }
+
+void voxelizer::voxel_list::upload(voxelizer::host_voxel_list const& host_voxel_list)
+{
+	alloc(host_voxel_list.size());
+
+	for (glm::uvec3 const& position : host_voxel_list.m_positions)
+	{
+		if (position.x >= k_voxel_list_max_side || position.y >= k_voxel_list_max_side || position.z >= k_voxel_list_max_side)
+			throw std::invalid_argument("Voxel position out of bounds, at most 21 bits per axis");
+	}
+
+	// Positions are stored as 64-bit Morton codes, that (on little-endian hosts) are laid out as (low, high) for the RG32UI format
+	std::vector<uint64_t> positions(host_voxel_list.size());
+	voxelizer::encode_morton_codes(host_voxel_list.m_positions.data(), positions.size(), positions.data());
+
+	glBindBuffer(GL_TEXTURE_BUFFER, m_position_buffer.m_buffer_name);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr) (positions.size() * sizeof(uint64_t)), positions.data());
+
+	glBindBuffer(GL_TEXTURE_BUFFER, m_color_buffer.m_buffer_name);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr) (host_voxel_list.m_colors.size() * sizeof(GLuint)), host_voxel_list.m_colors.data());
+
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void voxelizer::voxel_list::download(voxelizer::host_voxel_list& host_voxel_list) const
+{
+	std::vector<uint64_t> positions(m_size);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, m_position_buffer.m_buffer_name);
+	glGetBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr) (positions.size() * sizeof(uint64_t)), positions.data());
+
+	host_voxel_list.m_positions.resize(m_size);
+	voxelizer::decode_morton_codes(positions.data(), positions.size(), host_voxel_list.m_positions.data());
+
+	host_voxel_list.m_colors.resize(m_size);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, m_color_buffer.m_buffer_name);
+	glGetBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr) (m_size * sizeof(GLuint)), host_voxel_list.m_colors.data());
+
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
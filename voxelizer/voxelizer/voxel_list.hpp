@@ -1,20 +1,53 @@
 #pragma once
 
+#include <vector>
+
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 
 #include "gl.hpp"
+#include "octree.hpp"
 
 namespace voxelizer
 {
+	constexpr uint32_t k_voxel_list_max_side = 1u << 21; // Positions are stored as 64-bit Morton codes, 21 bits per axis.
+
+	// ------------------------------------------------------------------------------------------------
+	// host_voxel_list
+	// ------------------------------------------------------------------------------------------------
+
+	struct host_voxel_list
+	{
+		std::vector<glm::uvec3> m_positions;
+		std::vector<GLuint> m_colors; // RGBA8, same layout as the color buffer of voxel_list.
+
+		size_t size() const
+		{
+			return m_positions.size();
+		}
+	};
+
+	// ------------------------------------------------------------------------------------------------
+	// voxel_list
+	// ------------------------------------------------------------------------------------------------
+
 	struct voxel_list
 	{
-		voxelizer::texture_buffer m_position_buffer;
+		voxelizer::texture_buffer m_position_buffer; // RG32UI, 64-bit Morton codes (low, high), see get_morton_code_from_voxel_position.
 		voxelizer::texture_buffer m_color_buffer;
-		size_t m_size;
+		size_t m_size = 0;     // The voxels held.
+		size_t m_capacity = 0; // The voxels the buffers can hold.
 
 		voxel_list();
 
 		void alloc(size_t size);
+
+		/// Reallocates the buffers for the given capacity keeping the first kept voxels, m_size is set to kept.
+		void grow(size_t capacity, size_t kept);
+
 		void bind(GLuint position_binding, GLuint color_binding) const;
+
+		void upload(voxelizer::host_voxel_list const& host_voxel_list);
+		void download(voxelizer::host_voxel_list& host_voxel_list) const;
 	};
 }
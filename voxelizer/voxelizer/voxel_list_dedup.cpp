@@ -0,0 +1,186 @@
+#include "voxel_list_dedup.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+#include <shinji.hpp>
+
+static void copy_buffer(GLuint source, GLuint destination, size_t bytesize)
+{
+	glBindBuffer(GL_COPY_READ_BUFFER, source);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr) bytesize);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+voxelizer::voxel_list_dedup::voxel_list_dedup()
+{
+	std::pair<program*, char const*> programs[]{
+		{&m_radix_histogram, "resources/shaders/radix_histogram.comp"},
+		{&m_radix_scatter, "resources/shaders/radix_scatter.comp"},
+		{&m_dedup_flag, "resources/shaders/dedup_flag.comp"},
+		{&m_dedup_merge, "resources/shaders/dedup_merge.comp"},
+	};
+
+	for (auto& [program, path] : programs)
+	{
+		shader shader(GL_COMPUTE_SHADER);
+		shader.source_from_string(shinji::load_resource_from_bundle(path).m_data);
+		shader.compile();
+
+		program->attach_shader(shader);
+		program->link();
+	}
+
+	glGenBuffers(1, &m_keys);
+	glGenBuffers(1, &m_colors);
+	glGenBuffers(1, &m_counters);
+}
+
+voxelizer::voxel_list_dedup::~voxel_list_dedup()
+{
+	glDeleteBuffers(1, &m_keys);
+	glDeleteBuffers(1, &m_colors);
+	glDeleteBuffers(1, &m_counters);
+}
+
+void voxelizer::voxel_list_dedup::reserve(size_t size)
+{
+	if (size <= m_capacity)
+		return;
+
+	size_t group_count = (size + k_group_size - 1) / k_group_size;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_keys);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (size * sizeof(GLuint) * 2), nullptr, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_colors);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (size * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+
+	// Holds either the radix histogram (16 counters per group) or the dedup flags (one per voxel)
+	size_t counter_count = glm::max(group_count << k_radix_bits, size);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counters);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (counter_count * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	m_capacity = size;
+}
+
+void voxelizer::voxel_list_dedup::sort(voxelizer::voxel_list& voxel_list, uint32_t key_bits)
+{
+	if (key_bits > voxelizer::k_morton_bits_per_axis * 3)
+		throw std::invalid_argument("Too many key bits, Morton codes have at most 63 bits");
+
+	size_t count = voxel_list.m_size;
+	if (count <= 1)
+		return;
+
+	reserve(count);
+
+	size_t group_count = (count + k_group_size - 1) / k_group_size;
+
+	// The voxels go back and forth between the voxel-list and the scratch buffers
+	GLuint keys[2]{voxel_list.m_position_buffer.m_buffer_name, m_keys};
+	GLuint colors[2]{voxel_list.m_color_buffer.m_buffer_name, m_colors};
+	uint32_t src = 0;
+
+	for (uint32_t shift = 0; shift < key_bits; shift += k_radix_bits)
+	{
+		// histogram
+		m_radix_histogram.use();
+
+		glUniform1ui(m_radix_histogram.get_uniform_location("u_count"), (GLuint) count);
+		glUniform1ui(m_radix_histogram.get_uniform_location("u_shift"), shift);
+		glUniform1ui(m_radix_histogram.get_uniform_location("u_group_count"), (GLuint) group_count);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys[src]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counters);
+
+		dispatch_compute_1d(count, k_group_size);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Where the keys of every digit (and group) start
+		m_prefix_sum(m_counters, group_count << k_radix_bits);
+
+		// scatter
+		m_radix_scatter.use();
+
+		glUniform1ui(m_radix_scatter.get_uniform_location("u_count"), (GLuint) count);
+		glUniform1ui(m_radix_scatter.get_uniform_location("u_shift"), shift);
+		glUniform1ui(m_radix_scatter.get_uniform_location("u_group_count"), (GLuint) group_count);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys[src]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, colors[src]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counters);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, keys[1 - src]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, colors[1 - src]);
+
+		dispatch_compute_1d(count, k_group_size);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		src = 1 - src;
+	}
+
+	program::unuse();
+
+	if (src == 1)
+	{
+		copy_buffer(m_keys, voxel_list.m_position_buffer.m_buffer_name, count * sizeof(GLuint) * 2);
+		copy_buffer(m_colors, voxel_list.m_color_buffer.m_buffer_name, count * sizeof(GLuint));
+	}
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+size_t voxelizer::voxel_list_dedup::operator()(voxelizer::voxel_list& voxel_list, uint32_t resolution)
+{
+	size_t count = voxel_list.m_size;
+	if (count <= 1)
+		return count;
+
+	sort(voxel_list, resolution * 3);
+
+	// flag
+	m_dedup_flag.use();
+
+	glUniform1ui(m_dedup_flag.get_uniform_location("u_count"), (GLuint) count);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, voxel_list.m_position_buffer.m_buffer_name);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counters);
+
+	dispatch_compute_1d(count, k_group_size);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Where every merged voxel goes
+	size_t unique_count = m_prefix_sum(m_counters, count, true);
+
+	// merge
+	m_dedup_merge.use();
+
+	glUniform1ui(m_dedup_merge.get_uniform_location("u_count"), (GLuint) count);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, voxel_list.m_position_buffer.m_buffer_name);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, voxel_list.m_color_buffer.m_buffer_name);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counters);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_keys);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_colors);
+
+	dispatch_compute_1d(count, k_group_size);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	program::unuse();
+
+	copy_buffer(m_keys, voxel_list.m_position_buffer.m_buffer_name, unique_count * sizeof(GLuint) * 2);
+	copy_buffer(m_colors, voxel_list.m_color_buffer.m_buffer_name, unique_count * sizeof(GLuint));
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	printf("[voxel_list_dedup] Voxels: %zu, unique: %zu\n", count, unique_count);
+
+	voxel_list.m_size = unique_count;
+
+	return unique_count;
+}
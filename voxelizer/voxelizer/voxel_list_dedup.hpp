@@ -0,0 +1,44 @@
+#pragma once
+
+#include "gl.hpp"
+#include "prefix_sum.hpp"
+#include "voxel_list.hpp"
+
+namespace voxelizer
+{
+	/// Sorts a voxel-list by Morton code (LSD radix sort, 4 bits per pass) and merges the voxels with the same position,
+	/// averaging their colors. Everything runs on the GPU, the voxel-list is modified in place.
+	class voxel_list_dedup
+	{
+	private:
+		voxelizer::prefix_sum m_prefix_sum;
+
+		program m_radix_histogram;
+		program m_radix_scatter;
+		program m_dedup_flag;
+		program m_dedup_merge;
+
+		// Scratch buffers, kept between the calls and grown when needed
+		GLuint m_keys = 0;
+		GLuint m_colors = 0;
+		GLuint m_counters = 0; // Radix histogram, then dedup flags.
+		size_t m_capacity = 0;
+
+		void reserve(size_t size);
+
+	public:
+		static constexpr uint32_t k_radix_bits = 4;
+		static constexpr size_t k_group_size = 256;
+
+		voxel_list_dedup();
+		voxel_list_dedup(voxel_list_dedup const&) = delete;
+		~voxel_list_dedup();
+
+		/// Sorts the voxel-list by the first key_bits of the Morton codes (3 * resolution suffices for an octree).
+		/// The sort is stable.
+		void sort(voxelizer::voxel_list& voxel_list, uint32_t key_bits);
+
+		/// Sorts the voxel-list and leaves only one voxel per position. Returns the voxel count (voxel_list.m_size).
+		size_t operator()(voxelizer::voxel_list& voxel_list, uint32_t resolution);
+	};
+}
@@ -1,11 +1,14 @@
 #include "voxelize.hpp"
 
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include <glm/gtc/type_ptr.hpp>
 #include <shinji.hpp>
 
 #include "render_doc.hpp"
+#include "scene_batch.hpp"
 #include "voxel_list.hpp"
 
 voxelizer::voxelize::voxelize()
@@ -32,6 +35,19 @@ voxelizer::voxelize::voxelize()
 	glGenBuffers(1, &m_errors_counter);
 	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_errors_counter);
 	glBufferStorage(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+	// Mesh stats
+	glGenBuffers(1, &m_mesh_stats);
+
+	// Indirect draws (batched scenes)
+	glGenBuffers(1, &m_indirect_buffer);
+}
+
+voxelizer::voxelize::~voxelize()
+{
+	glDeleteBuffers(1, &m_errors_counter);
+	glDeleteBuffers(1, &m_mesh_stats);
+	glDeleteBuffers(1, &m_indirect_buffer);
 }
 
 glm::uvec3 voxelizer::voxelize::calc_proportional_grid(glm::vec3 size, uint32_t voxels_on_y)
@@ -61,20 +77,47 @@ void voxelizer::voxelize::create_projection_matrices(glm::mat4 m[3])
 	m[2] = ortho * glm::lookAt(glm::vec3(0, 0, +2.0f), glm::vec3(0), glm::vec3(0, 1.0f, 0));
 }
 
-void voxelizer::voxelize::invoke(voxelizer::scene const& scene)
+size_t voxelizer::voxelize::invoke(
+	voxelizer::scene const& scene,
+	glm::vec3 const& cull_min,
+	glm::vec3 const& cull_max,
+	uint32_t first_mesh,
+	size_t start_offset,
+	std::vector<size_t>* mesh_offsets
+)
 {
-	size_t voxel_list_offset = 0;
+	if (scene.m_batch && first_mesh == 0 && !mesh_offsets)
+		return invoke_batch(scene, *scene.m_batch, cull_min, cull_max);
+
+	glUniform1i(uniform_location::BATCHED, GL_FALSE);
+	glUniform1i(uniform_location::COUNT_DRAW_VOXELS, GL_FALSE);
+
+	// The per-mesh statistics are copied, on the GPU, to m_mesh_stats after every draw and read back once at the end
+	bool has_mesh_stats = m_log_meshes || mesh_offsets;
+
+	std::vector<uint32_t> drawn_meshes;
+	if (has_mesh_stats)
+	{
+		drawn_meshes.reserve(scene.m_meshes.size() - glm::min<size_t>(first_mesh, scene.m_meshes.size()));
+		reserve_mesh_stats(scene.m_meshes.size());
+	}
 
-	for (uint32_t mesh_idx = 0; mesh_idx < scene.m_meshes.size(); mesh_idx++)
+	reset_errors();
+
+	for (uint32_t mesh_idx = first_mesh; mesh_idx < scene.m_meshes.size(); mesh_idx++)
 	{
 		voxelizer::mesh const& mesh = scene.m_meshes[mesh_idx];
 
+		// Skips the meshes that can't generate any voxel
+		if (is_culled(mesh, cull_min, cull_max))
+			continue;
+
 		// Transform
-		glUniformMatrix4fv(m_program.get_uniform_location("u_mesh_transform"), 1, GL_FALSE, glm::value_ptr(mesh.m_transform));
+		glUniformMatrix4fv(uniform_location::MESH_TRANSFORM, 1, GL_FALSE, glm::value_ptr(mesh.m_transform));
 
 		// Color
 		glm::vec4 color = mesh.m_material->get_color(material::type::DIFFUSE);
-		glUniform4fv(m_program.get_uniform_location("u_color"), 1, glm::value_ptr(color));
+		glUniform4fv(uniform_location::COLOR, 1, glm::value_ptr(color));
 
 		GLuint texture = mesh.m_material->get_texture(material::type::DIFFUSE);
 		glBindTexture(GL_TEXTURE_2D, texture);
@@ -82,50 +125,242 @@ void voxelizer::voxelize::invoke(voxelizer::scene const& scene)
 		glBindVertexArray(mesh.m_vao);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_ebo);
 
-		// Reset errors counter
-		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_errors_counter);
-		glClearBufferSubData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, 0, sizeof(GLuint), GL_RED, GL_UNSIGNED_INT, nullptr);
+		voxelizer::renderdoc::watch(true, [&]
+		{
+			glDrawElements(GL_TRIANGLES, (GLsizei) mesh.m_element_count, mesh.m_index_type, (void*) mesh.m_index_offset);
+		});
+
+		if (has_mesh_stats)
+		{
+			// (voxel count, errors count) so far, no round trip to the CPU
+			GLintptr stats_offset = (GLintptr) (drawn_meshes.size() * sizeof(GLuint) * 2);
+
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+			glBindBuffer(GL_COPY_WRITE_BUFFER, m_mesh_stats);
+
+			glBindBuffer(GL_COPY_READ_BUFFER, m_atomic_counter.m_name);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, stats_offset, sizeof(GLuint));
+
+			glBindBuffer(GL_COPY_READ_BUFFER, m_errors_counter);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, stats_offset + sizeof(GLuint), sizeof(GLuint));
+
+			drawn_meshes.push_back(mesh_idx);
+		}
+	}
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// The only sync point of the pass
+	size_t voxel_list_offset = m_atomic_counter.get_value();
+	check_errors();
+
+	if (has_mesh_stats)
+	{
+		std::vector<GLuint> mesh_stats(drawn_meshes.size() * 2);
+		if (!drawn_meshes.empty())
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, m_mesh_stats);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr) (mesh_stats.size() * sizeof(GLuint)), mesh_stats.data());
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+
+		if (mesh_offsets)
+			mesh_offsets->assign(scene.m_meshes.size(), start_offset);
+
+		size_t offset = start_offset;
+		GLuint errors = 0;
+		for (size_t i = 0; i < drawn_meshes.size(); i++)
+		{
+			uint32_t mesh_idx = drawn_meshes[i];
+			size_t end_offset = mesh_stats[i * 2];
+
+			if (m_log_meshes)
+			{
+				printf("[voxelize] Mesh %d voxelized, voxels: %zu, offset: %zu, errors: %d\n",
+					mesh_idx,
+					end_offset - offset,
+					end_offset,
+					mesh_stats[i * 2 + 1] - errors
+				);
+			}
+
+			// Meshes that weren't drawn (culled) start where the next drawn one does
+			if (mesh_offsets)
+			{
+				uint32_t next_mesh_idx = i + 1 < drawn_meshes.size() ? drawn_meshes[i + 1] : (uint32_t) scene.m_meshes.size();
+				for (uint32_t j = mesh_idx + 1; j < next_mesh_idx; j++)
+					(*mesh_offsets)[j] = end_offset;
+
+				(*mesh_offsets)[mesh_idx] = offset;
+			}
+
+			offset = end_offset;
+			errors = mesh_stats[i * 2 + 1];
+		}
+	}
+
+	return voxel_list_offset;
+}
+
+size_t voxelizer::voxelize::invoke_batch(
+	voxelizer::scene const& scene,
+	voxelizer::scene_batch const& batch,
+	glm::vec3 const& cull_min,
+	glm::vec3 const& cull_max
+)
+{
+	glUniform1i(uniform_location::BATCHED, GL_TRUE);
+	glUniform1i(uniform_location::COUNT_DRAW_VOXELS, m_log_meshes);
+
+	// The culled draws are kept, with no instances
+	std::vector<voxelizer::scene_batch::draw_command> commands = batch.m_commands;
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		if (is_culled(scene.m_meshes[batch.m_mesh_indices[i]], cull_min, cull_max))
+			commands[i].m_instance_count = 0;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirect_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, (GLsizeiptr) (commands.size() * sizeof(voxelizer::scene_batch::draw_command)), commands.data(), GL_STREAM_DRAW);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, batch.m_draw_buffer);
+
+	if (m_log_meshes)
+	{
+		reserve_mesh_stats(commands.size());
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_mesh_stats);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, (GLsizeiptr) (commands.size() * sizeof(GLuint)), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 4, m_errors_counter);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_mesh_stats);
+	}
+
+	reset_errors();
+
+	glBindVertexArray(batch.m_vao);
+
+	for (voxelizer::scene_batch::texture_group const& group : batch.m_texture_groups)
+	{
+		glBindTexture(GL_TEXTURE_2D, group.m_texture);
 
 		voxelizer::renderdoc::watch(true, [&]
 		{
-			glDrawElements(GL_TRIANGLES, (GLsizei) mesh.m_element_count, GL_UNSIGNED_INT, nullptr);
+			glMultiDrawElementsIndirect(
+				GL_TRIANGLES,
+				GL_UNSIGNED_INT,
+				(void const*) (group.m_first_draw * sizeof(voxelizer::scene_batch::draw_command)),
+				(GLsizei) group.m_draw_count,
+				0
+			);
 		});
+	}
 
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 
-		size_t current_voxel_list_offset = m_atomic_counter.get_value();
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
-		printf("[voxelize] Mesh %d voxelized, voxels: %zu, offset: %zu\n",
-			mesh_idx,
-			(current_voxel_list_offset - voxel_list_offset),
-			current_voxel_list_offset
-		);
+	size_t voxel_count = m_atomic_counter.get_value();
+	check_errors();
 
-		voxel_list_offset = current_voxel_list_offset;
+	if (m_log_meshes && !commands.empty())
+	{
+		std::vector<GLuint> draw_voxels(commands.size());
 
-		GLuint errors_count{};
-		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_errors_counter);
-		glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &errors_count);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_mesh_stats);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr) (draw_voxels.size() * sizeof(GLuint)), draw_voxels.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-		if (errors_count > 0)
+		for (size_t i = 0; i < commands.size(); i++)
 		{
-			fprintf(stderr, "[voxelize] Errors: %d\n", errors_count);
-			fflush(stderr);
+			if (commands[i].m_instance_count > 0)
+				printf("[voxelize] Mesh %d voxelized, voxels: %d\n", batch.m_mesh_indices[i], draw_voxels[i]);
 		}
 	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	return voxel_count;
 }
 
-void voxelizer::voxelize::operator()(
-	voxelizer::voxel_list& voxel_list,
+void voxelizer::voxelize::reset_errors()
+{
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_errors_counter);
+	glClearBufferSubData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 4, m_errors_counter);
+}
+
+void voxelizer::voxelize::check_errors()
+{
+	GLuint errors_count{};
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_errors_counter);
+	glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &errors_count);
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+	if (errors_count > 0)
+	{
+		fprintf(stderr, "[voxelize] Errors: %d\n", errors_count);
+		fflush(stderr);
+	}
+}
+
+void voxelizer::voxelize::reserve_mesh_stats(size_t mesh_count)
+{
+	if (mesh_count <= m_mesh_stats_capacity)
+		return;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_mesh_stats);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) (mesh_count * sizeof(GLuint) * 2), nullptr, GL_DYNAMIC_READ);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	m_mesh_stats_capacity = mesh_count;
+}
+
+bool voxelizer::voxelize::is_culled(voxelizer::mesh const& mesh, glm::vec3 const& cull_min, glm::vec3 const& cull_max)
+{
+	return glm::any(glm::lessThan(mesh.m_transformed_max, cull_min)) || glm::any(glm::greaterThan(mesh.m_transformed_min, cull_max));
+}
+
+size_t voxelizer::voxelize::estimate_voxel_count(
 	voxelizer::scene const& scene,
-	uint32_t voxels_on_y,
+	glm::vec3 const& cull_min,
+	glm::vec3 const& cull_max,
+	float voxel_size
+)
+{
+	if (m_last_voxel_count > 0)
+		return m_last_voxel_count + m_last_voxel_count / 4;
+
+	// Every mesh is taken as the surface of its bounding box (clipped to the area), that is about what a closed mesh generates
+	double estimate = 0;
+	for (voxelizer::mesh const& mesh : scene.m_meshes)
+	{
+		if (is_culled(mesh, cull_min, cull_max))
+			continue;
+
+		glm::vec3 extent = (glm::min(mesh.m_transformed_max, cull_max) - glm::max(mesh.m_transformed_min, cull_min)) / voxel_size + 1.0f;
+		estimate += 2.0 * (double(extent.x) * extent.y + double(extent.y) * extent.z + double(extent.z) * extent.x);
+	}
+
+	return (size_t) glm::min(estimate, (double) m_max_estimated_voxel_count);
+}
+
+size_t voxelizer::voxelize::run(
+	voxelizer::voxel_list* voxel_list,
+	voxelizer::scene const& scene,
+	glm::uvec3 grid,
+	uint32_t viewport,
 	glm::vec3 area_position,
-	glm::vec3 area_size
+	float area_side,
+	size_t capacity,
+	size_t max_voxel_count
 )
 {
 	glDisable(GL_DEPTH_TEST);
@@ -137,75 +372,243 @@ void voxelizer::voxelize::operator()(
 	// Prepares a matrix responsible of framing the model in the said area.
 	// The min point will correspond to (0, 0, 0) while the max point to (1, 1, 1).
 
-	glm::mat4 scene_norm_mtx = voxelizer::voxelize::create_scene_normalization_matrix(area_position, area_size);
-	glUniformMatrix4fv(m_program.get_uniform_location("u_transform"), 1, GL_FALSE, glm::value_ptr(scene_norm_mtx));
+	pass_uniforms uniforms{};
+	uniforms.m_transform = voxelizer::voxelize::create_scene_normalization_matrix(area_position, glm::vec3(area_side));
 
 	// Creates the matrices that will project the triangles to the plane that gives
 	// out their widest area (to achieve Conservative Rasterization).
 
-	glm::mat4 proj[3];
-	create_projection_matrices(proj);
-
-	glUniformMatrix4fv(m_program.get_uniform_location("u_x_ortho_projection"), 1, GL_FALSE, glm::value_ptr(proj[0]));
-	glUniformMatrix4fv(m_program.get_uniform_location("u_y_ortho_projection"), 1, GL_FALSE, glm::value_ptr(proj[1]));
-	glUniformMatrix4fv(m_program.get_uniform_location("u_z_ortho_projection"), 1, GL_FALSE, glm::value_ptr(proj[2]));
+	create_projection_matrices(uniforms.m_projections);
 
-	// Finds out the size of the grid given just the number of voxels along the Y axis,
-	// other dimensions are found proportionally to that.
+	GLint max_viewport_dims[2]{};
+	GLint max_framebuffer_width{};
+	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport_dims);
+	glGetIntegerv(GL_MAX_FRAMEBUFFER_WIDTH, &max_framebuffer_width);
 
-	glm::uvec3 grid = voxelizer::voxelize::calc_proportional_grid(area_size, voxels_on_y);
+	uint32_t max_supported_side = (uint32_t) glm::min(glm::min(max_viewport_dims[0], max_viewport_dims[1]), max_framebuffer_width);
+	if (viewport > max_supported_side)
+		throw std::invalid_argument("Grid too large for the GPU voxelizer, max side: " + std::to_string(max_supported_side) + " (use the CPU voxelizer)");
 
-	uint32_t max_side = glm::max(grid.x, glm::max(grid.y, grid.z)); // The viewport is always a square, its side is the max side of the grid.
-	glUniform1ui(m_program.get_uniform_location("u_viewport"), max_side);
+	uniforms.m_grid = grid;
+	uniforms.m_viewport = viewport;
 
-	glUniform3uiv(m_program.get_uniform_location("u_grid"), 1, glm::value_ptr(grid));
+	m_pass_uniforms.update(uniforms);
+	m_pass_uniforms.bind(k_pass_uniforms_binding);
 
-	printf("[voxelize] Viewport of size (%d, %d)\n", max_side, max_side);
+	printf("[voxelize] Viewport of size (%d, %d)\n", viewport, viewport);
 
 	GLuint framebuffer{};
 	glGenFramebuffers(1, &framebuffer);
 	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_WIDTH, max_side);
-	glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_HEIGHT, max_side);
+	glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_WIDTH, viewport);
+	glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_HEIGHT, viewport);
+
+	glViewport(0, 0, (GLsizei) viewport, (GLsizei) viewport);
+
+	// The meshes outside of the voxelized area (with one voxel of margin) aren't drawn
+	float voxel_size = area_side / float(viewport);
+	glm::vec3 cull_min = area_position - voxel_size;
+	glm::vec3 cull_max = area_position + glm::vec3(grid) * voxel_size + voxel_size;
+
+	GLuint voxel_count;
+
+	if (!voxel_list || !m_single_pass)
+	{
+		// COUNT
+		// Runs the program and counts how many voxels are generated in order to allocate the buffer first
+		// and then fill it with the voxels.
+
+		glUniform1ui(uniform_location::CAPACITY, 0);
+
+		m_atomic_counter.set_value(0);
+		m_atomic_counter.bind(3);
+
+		voxel_count = (GLuint) invoke(scene, cull_min, cull_max);
+
+		if (voxel_list && voxel_count > max_voxel_count)
+		{
+			voxel_list->m_size = 0;
+
+			printf("[voxelize] Voxels over the limit (%d > %zu), not stored\n", voxel_count, max_voxel_count);
+		}
+		else if (voxel_list)
+		{
+			printf("[voxelize] Allocating a voxel-list of %d (~%zu bytes)\n", voxel_count, voxel_count * sizeof(GLuint) * 3);
+
+			voxel_list->alloc(voxel_count);
+
+			// STORE
+			// Now we can actually store the voxel list inside of the just-allocated buffer.
+
+			glUniform1ui(uniform_location::CAPACITY, voxel_count);
+
+			m_atomic_counter.set_value(0);
+			m_atomic_counter.bind(3);
 
-	glViewport(0, 0, (GLsizei) max_side, (GLsizei) max_side);
+			voxel_list->bind(1, 2);
 
-	// COUNT
-	// Runs the program and counts how many voxels are generated in order to allocate the buffer first
-	// and then fill it with the voxels.
+			invoke(scene, cull_min, cull_max);
 
-	glUniform1ui(m_program.get_uniform_location("u_can_store"), 0);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-	m_atomic_counter.set_value(0);
-	m_atomic_counter.bind(3);
+			printf("[voxelize] Voxel-list stored\n");
+		}
+	}
+	else
+	{
+		// STORE
+		// The voxel-list is allocated upfront (from the given capacity, the last run or an estimate) and filled in a single pass.
+		// The voxels past its capacity are only counted.
+
+		if (capacity == 0)
+			capacity = estimate_voxel_count(scene, cull_min, cull_max, voxel_size);
+		capacity = glm::max<size_t>(glm::min(capacity, max_voxel_count), 1);
+
+		printf("[voxelize] Allocating a voxel-list of %zu (~%zu bytes)\n", capacity, capacity * sizeof(GLuint) * 3);
+
+		voxel_list->alloc(capacity);
+
+		glUniform1ui(uniform_location::CAPACITY, (GLuint) capacity);
+
+		m_atomic_counter.set_value(0);
+		m_atomic_counter.bind(3);
+
+		voxel_list->bind(1, 2);
+
+		std::vector<size_t> mesh_offsets;
+		voxel_count = (GLuint) invoke(scene, cull_min, cull_max, 0, 0, scene.m_batch ? nullptr : &mesh_offsets);
+
+		// RETRY
+		// On overflow the voxels of the meshes before the first one that overflowed are kept, the voxel-list is grown
+		// to the now known count and only the remaining meshes are drawn again. Over max_voxel_count only the count is kept.
+
+		if (voxel_count > max_voxel_count)
+		{
+			voxel_list->m_size = 0;
 
-	invoke(scene);
+			printf("[voxelize] Voxels over the limit (%d > %zu), not stored\n", voxel_count, max_voxel_count);
+		}
+		else if (voxel_count > capacity)
+		{
+			// The voxels of a batched scene aren't ordered by mesh, it's drawn again as a whole
+			uint32_t first_mesh = 0;
+			while (!scene.m_batch && first_mesh + 1 < mesh_offsets.size() && mesh_offsets[first_mesh + 1] <= capacity)
+				first_mesh++;
 
-	GLuint voxel_count = m_atomic_counter.get_value();
+			size_t kept = scene.m_batch ? 0 : mesh_offsets[first_mesh];
 
-	printf("[voxelize] Allocating a voxel-list of %d (~%zu bytes)\n", voxel_count, voxel_count * sizeof(GLuint) * 2);
+			printf("[voxelize] Voxel-list overflow (%d > %zu), growing and voxelizing again from mesh %d\n", voxel_count, capacity, first_mesh);
 
-	voxel_list.alloc(voxel_count);
+			voxel_list->grow(voxel_count, kept);
 
-	// STORE
-	// Now we can actually store the voxel list inside of the just-allocated buffer.
+			glUniform1ui(uniform_location::CAPACITY, voxel_count);
 
-	glUniform1ui(m_program.get_uniform_location("u_can_store"), 1);
+			m_atomic_counter.set_value((GLuint) kept);
+			m_atomic_counter.bind(3);
 
-	m_atomic_counter.set_value(0);
-	m_atomic_counter.bind(3);
+			voxel_list->bind(1, 2);
 
-	voxel_list.bind(1, 2);
+			invoke(scene, cull_min, cull_max, first_mesh, kept);
+		}
 
-	invoke(scene);
+		if (voxel_count <= max_voxel_count)
+		{
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			voxel_list->m_size = voxel_count;
+			m_last_voxel_count = voxel_count;
 
-	printf("[voxelize] Voxel-list stored\n");
+			printf("[voxelize] Voxel-list stored, voxels: %d, capacity: %zu\n", voxel_count, voxel_list->m_capacity);
+		}
+	}
 
 	//
 
 	voxelizer::program::unuse();
 
 	glDeleteFramebuffers(1, &framebuffer);
+
+	return voxel_count;
+}
+
+void voxelizer::voxelize::operator()(
+	voxelizer::voxel_list& voxel_list,
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size
+)
+{
+	// Finds out the size of the grid given just the number of voxels along the Y axis,
+	// other dimensions are found proportionally to that.
+
+	glm::uvec3 grid = voxelizer::voxelize::calc_proportional_grid(area_size, voxels_on_y);
+
+	uint32_t max_side = glm::max(grid.x, glm::max(grid.y, grid.z)); // The viewport is always a square, its side is the max side of the grid.
+	float max_area_side = glm::max(area_size.x, glm::max(area_size.y, area_size.z));
+
+	run(&voxel_list, scene, grid, max_side, area_position, max_area_side, 0);
+}
+
+size_t voxelizer::voxelize::run_region(
+	voxelizer::voxel_list* voxel_list,
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size,
+	glm::uvec3 region_min,
+	uint32_t region_side,
+	size_t capacity,
+	size_t max_voxel_count
+)
+{
+	// The same voxel size of the whole grid, so that the voxels of the region are aligned to the whole grid ones
+	glm::uvec3 grid = voxelizer::voxelize::calc_proportional_grid(area_size, voxels_on_y);
+
+	uint32_t max_side = glm::max(grid.x, glm::max(grid.y, grid.z));
+	float voxel_size = glm::max(area_size.x, glm::max(area_size.y, area_size.z)) / float(max_side);
+
+	glm::uvec3 region_grid = glm::min(grid - glm::min(region_min, grid), glm::uvec3(region_side));
+
+	return run(voxel_list, scene, region_grid, region_side, area_position + glm::vec3(region_min) * voxel_size, float(region_side) * voxel_size, capacity, max_voxel_count);
+}
+
+void voxelizer::voxelize::operator()(
+	voxelizer::voxel_list& voxel_list,
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size,
+	glm::uvec3 region_min,
+	uint32_t region_side,
+	size_t capacity
+)
+{
+	run_region(&voxel_list, scene, voxels_on_y, area_position, area_size, region_min, region_side, capacity);
+}
+
+size_t voxelizer::voxelize::try_voxelize(
+	voxelizer::voxel_list& voxel_list,
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size,
+	glm::uvec3 region_min,
+	uint32_t region_side,
+	size_t max_voxel_count
+)
+{
+	return run_region(&voxel_list, scene, voxels_on_y, area_position, area_size, region_min, region_side, 0, max_voxel_count);
+}
+
+size_t voxelizer::voxelize::count(
+	voxelizer::scene const& scene,
+	uint32_t voxels_on_y,
+	glm::vec3 area_position,
+	glm::vec3 area_size,
+	glm::uvec3 region_min,
+	uint32_t region_side
+)
+{
+	return run_region(nullptr, scene, voxels_on_y, area_position, area_size, region_min, region_side, 0);
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <optional>
+#include <vector>
 
 #include <glm/glm.hpp>
 
@@ -13,14 +15,103 @@ namespace voxelizer
 	struct voxelize
 	{
 	private:
-		void invoke(voxelizer::scene const& scene);
+		enum uniform_location // The explicit locations of the per-draw uniforms (see voxelize.vert and voxelize.frag).
+		{
+			MESH_TRANSFORM = 5,
+			COLOR = 6,
+			TEXTURE = 7,
+			CAPACITY = 8,
+			BATCHED = 9,
+			COUNT_DRAW_VOXELS = 10
+		};
+
+		struct pass_uniforms // Same layout as ubo_voxelize_pass (std140), written once per pass.
+		{
+			glm::mat4 m_transform;
+			glm::mat4 m_projections[3]; // Along X, Y and Z.
+			glm::uvec3 m_grid;
+			GLuint m_viewport;
+		};
+
+		static constexpr GLuint k_pass_uniforms_binding = 0;
+
+		voxelizer::uniform_buffer<pass_uniforms> m_pass_uniforms;
+
+		/// Draws the meshes from first_mesh on, the atomic counter must hold start_offset. If given, mesh_offsets receives
+		/// the voxel-list offset every mesh started at. Returns the voxel count after the last mesh.
+		/// The scene batch, if any, is used unless the meshes are drawn one by one to get their offsets or to skip some.
+		size_t invoke(
+			voxelizer::scene const& scene,
+			glm::vec3 const& cull_min,
+			glm::vec3 const& cull_max,
+			uint32_t first_mesh = 0,
+			size_t start_offset = 0,
+			std::vector<size_t>* mesh_offsets = nullptr
+		);
+
+		/// Draws the scene through its batch, one glMultiDrawElementsIndirect per texture. The culled draws have no instances.
+		size_t invoke_batch(
+			voxelizer::scene const& scene,
+			voxelizer::scene_batch const& batch,
+			glm::vec3 const& cull_min,
+			glm::vec3 const& cull_max
+		);
+
+		void reset_errors();
+		void check_errors();
+
+		void reserve_mesh_stats(size_t mesh_count);
+
+		static bool is_culled(voxelizer::mesh const& mesh, glm::vec3 const& cull_min, glm::vec3 const& cull_max);
+
+		size_t estimate_voxel_count(voxelizer::scene const& scene, glm::vec3 const& cull_min, glm::vec3 const& cull_max, float voxel_size);
+
+		/// Voxelizes a grid whose voxel (0, 0, 0) starts at area_position, viewport voxels span area_side. If voxel_list is null
+		/// it only counts the voxels, as it does when they're more than max_voxel_count. Returns the voxel count.
+		size_t run(
+			voxelizer::voxel_list* voxel_list,
+			voxelizer::scene const& scene,
+			glm::uvec3 grid,
+			uint32_t viewport,
+			glm::vec3 area_position,
+			float area_side,
+			size_t capacity,
+			size_t max_voxel_count = SIZE_MAX
+		);
+
+		size_t run_region(
+			voxelizer::voxel_list* voxel_list,
+			voxelizer::scene const& scene,
+			uint32_t voxels_on_y,
+			glm::vec3 area_position,
+			glm::vec3 area_size,
+			glm::uvec3 region_min,
+			uint32_t region_side,
+			size_t capacity,
+			size_t max_voxel_count = SIZE_MAX
+		);
 
 	public:
 		program m_program;
 		atomic_counter m_atomic_counter;
 		GLuint m_errors_counter;
 
+		GLuint m_mesh_stats; // (voxel count, errors count) after every drawn mesh, or the voxel count of every batched draw.
+		GLuint m_indirect_buffer;
+		size_t m_mesh_stats_capacity = 0;
+
+		bool m_log_meshes = false; // Logs the voxels generated by every mesh, the stats are only gathered if needed.
+
+		/// Rasterizes the scene once into a voxel-list allocated upfront, re-drawing only the meshes that overflowed it.
+		/// When false the scene is rasterized twice: once to count the voxels and once to store them.
+		bool m_single_pass = true;
+
+		size_t m_last_voxel_count = 0; // The voxel-list capacity of the next single pass run, the estimate is used if 0.
+		size_t m_max_estimated_voxel_count = 1 << 24;
+
 		voxelize();
+		voxelize(voxelize const&) = delete;
+		~voxelize();
 
 		static glm::uvec3 calc_proportional_grid(glm::vec3 size, uint32_t voxels_on_y);
 		static glm::mat4 create_scene_normalization_matrix(glm::vec3 area_position, glm::vec3 area_size);
@@ -40,5 +131,51 @@ namespace voxelizer
 			glm::vec3 area_position,
 			glm::vec3 area_size
 		);
+
+		/**
+		 * Voxelizes only a cubic region of the grid defined by voxels_on_y, area_position and area_size (as above).
+		 * Voxel positions are relative to region_min. Meshes outside of the region aren't drawn.
+		 *
+		 * @param region_min  The first voxel of the region.
+		 * @param region_side The side of the region in voxels, voxels outside of the grid are discarded.
+		 * @param capacity    The expected voxel count (e.g. from count()), if 0 it's estimated.
+		 */
+		void operator()(
+			voxelizer::voxel_list& voxel_list,
+			voxelizer::scene const& scene,
+			uint32_t voxels_on_y,
+			glm::vec3 area_position,
+			glm::vec3 area_size,
+			glm::uvec3 region_min,
+			uint32_t region_side,
+			size_t capacity = 0
+		);
+
+		/**
+		 * Like the region operator() but stores the voxels only if they're at most max_voxel_count, otherwise it just counts them
+		 * (as count() does). Either way the scene is rasterized once, a voxel-list overflow aside.
+		 *
+		 * @return The voxel count (duplicates included), voxel_list is left empty if it's over max_voxel_count.
+		 */
+		size_t try_voxelize(
+			voxelizer::voxel_list& voxel_list,
+			voxelizer::scene const& scene,
+			uint32_t voxels_on_y,
+			glm::vec3 area_position,
+			glm::vec3 area_size,
+			glm::uvec3 region_min,
+			uint32_t region_side,
+			size_t max_voxel_count
+		);
+
+		/// Like the region operator() but only counts the voxels (duplicates included), nothing is stored.
+		size_t count(
+			voxelizer::scene const& scene,
+			uint32_t voxels_on_y,
+			glm::vec3 area_position,
+			glm::vec3 area_size,
+			glm::uvec3 region_min,
+			uint32_t region_side
+		);
 	};
 }